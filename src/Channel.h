@@ -0,0 +1,45 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <string>
+#include <string_view>
+
+#include "IdManager.h"
+
+/**
+    Handle to a packet type that is resolved from its name once, up front,
+    so that posting and subscribing need no string lookups:
+
+        const Channel<Pose> pose(muxer.getIdManager(), "Pose");
+        serialise(muxer, pose, currentPose);
+
+    T is the type the payload is serialised from (see PacketSerialisation.h).
+    Channel<> (T = void) is for raw payloads. See also Protocol, which
+    produces channels at compile time.
+
+    The handle is only valid for muxers/demuxers built from the same packet list.
+*/
+template <typename T = void>
+class Channel {
+ public:
+  typedef T ValueType;
+
+  constexpr Channel()
+      : m_id(IdManager::InvalidPacket) {}
+
+  /// Use an id known in advance (e.g. from a Protocol).
+  constexpr explicit Channel(IdManager::PacketType id)
+      : m_id(id) {}
+
+  /// @throws std::out_of_range if there is no packet type with the name.
+  Channel(const IdManager& ids, std::string_view name)
+      : m_id(ids.toId(name)) {}
+
+  constexpr IdManager::PacketType id() const { return m_id; }
+  constexpr bool valid() const { return m_id != IdManager::InvalidPacket; }
+
+ private:
+  IdManager::PacketType m_id;
+};
+
+#endif  // CHANNEL_H
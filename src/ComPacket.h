@@ -4,67 +4,178 @@
 #ifndef __COM_PACKET_H__
 #define __COM_PACKET_H__
 
+#include <assert.h>
+
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <queue>
 #include <type_traits>
 #include <vector>
 
 #include "IdManager.h"
+#include "PacketBufferPool.h"
 #include "VectorStream.h"
 
+/// Payloads up to this many bytes are stored inside the ComPacket itself
+/// instead of in a separately allocated buffer. Must be the same for every
+/// translation unit (set it from the build rather than per file):
+#ifndef PACKETCOMMS_INLINE_PAYLOAD_SIZE
+#define PACKETCOMMS_INLINE_PAYLOAD_SIZE 64
+#endif
+
+/**
+    A packet of data and its type ID.
+
+    Normally the packet owns its payload, but the payload can also be
+    memory owned externally (e.g. a frame in a camera's buffer pool) so
+    that large packets can be muxed without copying. External memory is
+    released when the last reference to the packet goes away (for a muxed
+    packet that is once it has been written to the transport).
+
+    Small payloads (control messages, heartbeats, short commands) are
+    stored inline so that copying them in does not allocate.
+*/
 class ComPacket {
  public:
   typedef std::shared_ptr<ComPacket> SharedPacket;
   typedef std::shared_ptr<const ComPacket> ConstSharedPacket;
   typedef std::queue<SharedPacket> PacketContainer;
 
+  /// Called once an externally owned payload is no longer referenced by the packet:
+  typedef std::function<void()> ReleaseCallBack;
+
+  /// Largest payload that is stored inline:
+  static constexpr std::size_t InlineCapacity = PACKETCOMMS_INLINE_PAYLOAD_SIZE;
+
   ComPacket(const ComPacket&) = delete;
   ComPacket& operator=(const ComPacket&) = delete;
 
   /// Default constructed invalid packet:
   ComPacket()
-      : m_type(IdManager::InvalidPacket) {}
+      : m_type(IdManager::InvalidPacket), m_ptr(nullptr), m_size(0) {}
 
   /// Construct a com packet from raw buffer of stream data:
   ComPacket(IdManager::PacketType type, const VectorStream::CharType* buffer, int size)
-      : m_type(type), m_data(buffer, buffer + size) {}
+      : m_type(type), m_size(size) {
+    if (fitsInline(m_size)) {
+      m_ptr = m_inline;
+    } else {
+      m_data.resize(m_size);
+      m_ptr = m_data.data();
+    }
+    std::copy(buffer, buffer + m_size, m_ptr);
+  }
 
   ComPacket(IdManager::PacketType type, VectorStream::Buffer&& buffer)
       : m_type(type) {
     std::swap(m_data, buffer);
+    m_ptr  = m_data.data();
+    m_size = m_data.size();
   }
 
   /// Construct ComPacket with preallocated data size (but no valid data).
   ComPacket(IdManager::PacketType type, int size)
-      : m_type(type), m_data(size) {}
+      : m_type(type), m_size(size) {
+    if (fitsInline(m_size)) {
+      std::fill(m_inline, m_inline + m_size, VectorStream::CharType(0));
+      m_ptr = m_inline;
+    } else {
+      m_data.resize(m_size);
+      m_ptr = m_data.data();
+    }
+  }
+
+  /// Construct ComPacket with its (uninitialised) payload in a pooled buffer.
+  ComPacket(IdManager::PacketType type, PooledBuffer&& buffer)
+      : m_type(type), m_ptr(buffer.data()), m_size(buffer.size()), m_pooled(std::move(buffer)) {}
+
+  /// Construct ComPacket whose payload is the first size bytes of a pooled buffer.
+  ComPacket(IdManager::PacketType type, PooledBuffer&& buffer, std::size_t size)
+      : m_type(type), m_ptr(buffer.data()), m_size(size), m_pooled(std::move(buffer)) {
+    assert(size <= m_pooled.size());
+  }
+
+  /// Construct a ComPacket that refers to (but does not copy) externally owned memory.
+  /// The owner is held until the packet is destroyed so it must keep the memory valid.
+  ComPacket(IdManager::PacketType type, std::shared_ptr<const void> owner, const VectorStream::CharType* buffer, std::size_t size)
+      : m_type(type), m_ptr(const_cast<VectorStream::CharType*>(buffer)), m_size(size), m_owner(std::move(owner)) {}
+
+  /// Construct a ComPacket that refers to (but does not copy) externally owned memory.
+  /// The memory must remain valid until release is called (e.g. it could return the buffer to a pool).
+  ComPacket(IdManager::PacketType type, const VectorStream::CharType* buffer, std::size_t size, ReleaseCallBack release)
+      : ComPacket(type, std::shared_ptr<const void>(buffer, [release](const void*) { release(); }), buffer, size) {}
 
   virtual ~ComPacket() {}
 
   /// @param p The ComPacket to be moved - it will become of invalid type, with an empty data vector.
   ComPacket(ComPacket&& p)
-      : m_type(IdManager::InvalidPacket) {
-    std::swap(p.m_type, m_type);
-    std::swap(p.m_data, m_data);
-  };  /// @todo use delgating constructor to create  invalid packet when upgraded to gcc-4.7+
+      : ComPacket() {
+    swap(p);
+  }
 
   ComPacket& operator=(ComPacket&& p) {
-    std::swap(p.m_type, m_type);
-    std::swap(p.m_data, m_data);
+    swap(p);
     return *this;
   };
 
   IdManager::PacketType getType() const { return m_type; };
-  const VectorStream::CharType* getDataPtr() const { return m_data.data(); };
-  VectorStream::CharType* getDataPtr() { return m_data.data(); };
-  std::vector<VectorStream::CharType>::size_type getDataSize() const noexcept { return m_data.size(); };
-  const std::vector<VectorStream::CharType>& getData() const { return m_data; };
-  std::vector<VectorStream::CharType>& getData() { return m_data; };
+  const VectorStream::CharType* getDataPtr() const { return m_ptr; };
+
+  /// @note Must not be used to modify an externally owned payload that is shared with other code.
+  VectorStream::CharType* getDataPtr() { return m_ptr; };
+  std::size_t getDataSize() const noexcept { return m_size; };
+
+  /// @return true if the payload is memory owned outside of the packet.
+  bool isExternal() const { return m_owner != nullptr; }
+
+  /// @return true if the payload is stored inside the packet.
+  bool isInline() const { return m_ptr == m_inline; }
+
+  static constexpr bool fitsInline(std::size_t size) { return size <= InlineCapacity; }
 
  protected:
  private:
+  void swap(ComPacket& p) {
+    // Inline payloads have to be exchanged by value and their pointers
+    // re-targeted (only the bytes in use are copied):
+    const bool inlined      = isInline();
+    const bool otherInlined = p.isInline();
+    VectorStream::CharType tmp[sizeof(m_inline)];
+    if (inlined) {
+      std::copy(m_inline, m_inline + m_size, tmp);
+    }
+    if (otherInlined) {
+      std::copy(p.m_inline, p.m_inline + p.m_size, m_inline);
+    }
+    if (inlined) {
+      std::copy(tmp, tmp + m_size, p.m_inline);
+    }
+
+    std::swap(p.m_type, m_type);
+    std::swap(p.m_data, m_data);
+    std::swap(p.m_ptr, m_ptr);
+    std::swap(p.m_size, m_size);
+    std::swap(p.m_owner, m_owner);
+    std::swap(p.m_pooled, m_pooled);
+
+    if (inlined) {
+      p.m_ptr = p.m_inline;
+    }
+    if (otherInlined) {
+      m_ptr = m_inline;
+    }
+  }
+
   IdManager::PacketType m_type;
   VectorStream::Buffer m_data;
+  VectorStream::CharType* m_ptr;
+  std::size_t m_size;
+  std::shared_ptr<const void> m_owner;
+  PooledBuffer m_pooled;
+  alignas(std::uint64_t) VectorStream::CharType m_inline[InlineCapacity > 0 ? InlineCapacity : 1];
 };
 
 #endif /* __COM_PACKET_H__ */
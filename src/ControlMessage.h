@@ -9,4 +9,9 @@ enum class ControlMessage : std::uint8_t {
   GoodBye   = 255
 };
 
+/// Set in the type word of a frame header when the frame is a fragment of a larger
+/// packet and more fragments of the same type follow. The final fragment (like an
+/// unfragmented packet) has the flag clear. See MuxerOptions::maxFragmentSize.
+constexpr std::uint32_t MoreFragmentsFlag = 0x80000000u;
+
 #endif  // MUXERCONTROLMESSAGES_H
@@ -0,0 +1,20 @@
+#ifndef DEMUXEROPTIONS_H
+#define DEMUXEROPTIONS_H
+
+#include <cstddef>
+
+/**
+    Options for configuring a PacketDemuxer. These are fixed once the demuxer is constructed.
+*/
+struct DemuxerOptions {
+  /// If false the demuxer starts no receive thread and is driven externally, by
+  /// PacketDemuxer::poll() or a Reactor. Callbacks are then called on the driving thread:
+  bool receiveThread = true;
+
+  /// Largest packet reassembled from fragments (see MuxerOptions::maxFragmentSize),
+  /// or zero for no limit. The fragments of a larger packet are discarded and it is
+  /// counted as an unknown packet, so a peer can not grow the receiver's memory without bound:
+  std::size_t maxReassembledBytes = 64 * 1024 * 1024;
+};
+
+#endif  // DEMUXEROPTIONS_H
@@ -2,5 +2,35 @@
 
 constexpr IdManager::PacketType IdManager::InvalidPacket;
 constexpr IdManager::PacketType IdManager::ControlPacket;
+constexpr IdManager::PacketType IdManager::EmptySlot;
 const std::string IdManager::InvalidString = "__INVALID__";
 const std::string IdManager::ControlString = "__CONTROL__";
+
+IdManager::IdManager(const std::vector<std::string>& list) {
+  m_reverse.reserve(list.size() + 2);
+  m_reverse.push_back(InvalidString);
+  m_reverse.push_back(ControlString);
+  m_reverse.insert(m_reverse.end(), list.begin(), list.end());
+
+  // Keep the table at most half full so probe sequences stay short:
+  std::size_t capacity = 8;
+  while (capacity < 2 * m_reverse.size()) {
+    capacity *= 2;
+  }
+  m_table.assign(capacity, Slot{0, EmptySlot});
+  m_mask = capacity - 1;
+
+  for (std::size_t id = 0; id < m_reverse.size(); ++id) {
+    insert(m_reverse[id], static_cast<PacketType>(id));
+  }
+}
+
+void IdManager::insert(const std::string& name, PacketType id) {
+  const std::uint64_t hash = hashName(name);
+  std::size_t slot         = hash & m_mask;
+  while (m_table[slot].id != EmptySlot) {
+    assert(m_reverse[m_table[slot].id] != name);  // Packet names must be unique
+    slot = (slot + 1) & m_mask;
+  }
+  m_table[slot] = Slot{static_cast<std::uint32_t>(hash >> 32), id};
+}
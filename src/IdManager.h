@@ -3,10 +3,19 @@
 
 #include <assert.h>
 #include <cstdint>
-#include <map>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
+/**
+    Maps packet type names to dense numeric ids and back.
+
+    Names are looked up in an open addressing hash table (linear probing)
+    that is built once at construction and never modified, so lookups are
+    O(1), take std::string_view and never allocate. Ids index straight into
+    the array of names.
+*/
 class IdManager {
  public:
   typedef std::uint32_t PacketType;
@@ -15,29 +24,54 @@ class IdManager {
   static const std::string InvalidString;
   static const std::string ControlString;
 
-  IdManager(const std::vector<std::string>& list) {
-    m_map[InvalidString] = InvalidPacket;
-    m_reverse.push_back(InvalidString);
-    m_map[ControlString] = ControlPacket;
-    m_reverse.push_back(ControlString);
-
-    std::size_t id = ControlPacket;
-    for (const std::string& name : list) {
-      assert(m_map.find(name) == m_map.end());
-      id += 1;
-      m_map[name] = id;
-      m_reverse.push_back(name);
+  IdManager(const std::vector<std::string>& list);
+  virtual ~IdManager() {}
+
+  /// @throws std::out_of_range if there is no packet type with the name.
+  PacketType toId(std::string_view name) const {
+    const std::uint64_t hash = hashName(name);
+    for (std::size_t slot = hash & m_mask;; slot = (slot + 1) & m_mask) {
+      const Slot& s = m_table[slot];
+      if (s.id == EmptySlot) {
+        throw std::out_of_range("Unknown packet type name");
+      }
+      if (s.hash == static_cast<std::uint32_t>(hash >> 32) && m_reverse[s.id] == name) {
+        return s.id;
+      }
     }
   }
 
-  virtual ~IdManager() {}
+  /// @throws std::out_of_range if the id is not valid.
+  const std::string& toString(const PacketType id) const { return m_reverse.at(id); }
 
-  PacketType toId(const std::string& name) const { return m_map.at(name); }
-  const std::string& toString(const PacketType id) const { return m_reverse[id]; }
+  /// Number of packet types including the internal invalid and control types.
+  /// Ids are dense so every id is less than size().
+  std::size_t size() const { return m_reverse.size(); }
 
  private:
-  std::map<std::string, PacketType> m_map;
+  static constexpr PacketType EmptySlot = ~PacketType(0);
+
+  /// The upper half of the name's hash is kept to skip most string comparisons on collisions:
+  struct Slot {
+    std::uint32_t hash;
+    PacketType id;
+  };
+
+  /// 64-bit FNV-1a:
+  static std::uint64_t hashName(std::string_view name) {
+    std::uint64_t hash = 14695981039346656037ull;
+    for (const char c : name) {
+      hash ^= static_cast<unsigned char>(c);
+      hash *= 1099511628211ull;
+    }
+    return hash;
+  }
+
+  void insert(const std::string& name, PacketType id);
+
   std::vector<std::string> m_reverse;
+  std::vector<Slot> m_table;
+  std::size_t m_mask;
 };
 
 #endif  // IDMANAGER_H
@@ -0,0 +1,83 @@
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+LatencyHistogram::LatencyHistogram()
+    : m_count(0), m_max(0) {
+  for (auto& bucket : m_buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+}
+
+/**
+    Values below SubBuckets have a bucket each. Above that the bucket is
+    chosen by the position of the highest set bit and the SubBucketBits
+    bits below it.
+*/
+std::size_t LatencyHistogram::bucketIndex(std::uint64_t ns) {
+  ns = std::min<std::uint64_t>(ns, (std::uint64_t(1) << MaxBits) - 1);
+  if (ns < SubBuckets) {
+    return ns;
+  }
+
+  unsigned highBit = 0;
+  for (unsigned shift = 32; shift > 0; shift /= 2) {
+    if (ns >> (highBit + shift)) {
+      highBit += shift;
+    }
+  }
+
+  const std::uint64_t sub = (ns >> (highBit - SubBucketBits)) - SubBuckets;
+  return (highBit - SubBucketBits + 1) * SubBuckets + sub;
+}
+
+/**
+    @return The largest value that is counted in the bucket.
+*/
+std::uint64_t LatencyHistogram::bucketUpperBound(std::size_t index) {
+  if (index < SubBuckets) {
+    return index;
+  }
+
+  const unsigned highBit    = index / SubBuckets + SubBucketBits - 1;
+  const std::uint64_t sub   = index % SubBuckets;
+  const unsigned shift      = highBit - SubBucketBits;
+  const std::uint64_t lower = (SubBuckets + sub) << shift;
+  return lower + (std::uint64_t(1) << shift) - 1;
+}
+
+/**
+    @param percent In the range [0, 100].
+    @return The smallest duration that at least percent of the recorded durations
+    do not exceed (to the resolution of the buckets and never more than the maximum).
+*/
+std::chrono::nanoseconds LatencyHistogram::percentile(double percent) const {
+  const std::uint64_t total = count();
+  if (total == 0) {
+    return std::chrono::nanoseconds(0);
+  }
+
+  const double fraction      = std::min(std::max(percent, 0.0), 100.0) / 100.0;
+  const std::uint64_t target = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(fraction * total)));
+  const std::uint64_t max    = m_max.load(std::memory_order_relaxed);
+
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < NumBuckets; ++i) {
+    seen += m_buckets[i].load(std::memory_order_relaxed);
+    if (seen >= target) {
+      return std::chrono::nanoseconds(std::min(bucketUpperBound(i), max));
+    }
+  }
+  return std::chrono::nanoseconds(max);
+}
+
+LatencySummary LatencyHistogram::summary() const {
+  LatencySummary s;
+  s.count = count();
+  s.p50   = percentile(50.0);
+  s.p99   = percentile(99.0);
+  s.p999  = percentile(99.9);
+  s.max   = std::chrono::nanoseconds(m_max.load(std::memory_order_relaxed));
+  return s;
+}
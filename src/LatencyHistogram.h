@@ -0,0 +1,66 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/**
+    Percentiles of a LatencyHistogram. All zero if nothing was recorded.
+*/
+struct LatencySummary {
+  std::uint64_t count = 0;
+  std::chrono::nanoseconds p50{0};
+  std::chrono::nanoseconds p99{0};
+  std::chrono::nanoseconds p999{0};
+  std::chrono::nanoseconds max{0};
+};
+
+/**
+    Lock-free histogram of durations with log-linear buckets (in the style
+    of an HDR histogram): each power of two range of nanoseconds is split
+    into 32 linear sub-buckets, so values are resolved to within about 3%
+    from 1ns up to the maximum of about 18 minutes (longer durations are
+    counted as the maximum).
+
+    record() is wait-free and may be called from any thread. Reading the
+    histogram concurrently is safe; a summary taken while values are being
+    recorded may just miss the most recent ones.
+*/
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  void record(std::chrono::nanoseconds duration) {
+    const std::uint64_t ns = duration.count() > 0 ? static_cast<std::uint64_t>(duration.count()) : 0;
+    m_buckets[bucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+
+    std::uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (ns > max && !m_max.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+    }
+  }
+
+  std::uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+  std::chrono::nanoseconds percentile(double percent) const;
+  LatencySummary summary() const;
+
+ private:
+  static constexpr unsigned SubBucketBits  = 5;
+  static constexpr std::uint64_t SubBuckets = 1u << SubBucketBits;
+  static constexpr unsigned MaxBits        = 40;
+  static constexpr std::size_t NumBuckets  = (MaxBits - SubBucketBits + 1) * SubBuckets;
+
+  static std::size_t bucketIndex(std::uint64_t ns);
+  static std::uint64_t bucketUpperBound(std::size_t index);
+
+  std::array<std::atomic<std::uint64_t>, NumBuckets> m_buckets;
+  std::atomic<std::uint64_t> m_count;
+  std::atomic<std::uint64_t> m_max;
+};
+
+#endif  // LATENCYHISTOGRAM_H
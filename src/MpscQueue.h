@@ -0,0 +1,76 @@
+#ifndef __MPSC_QUEUE_H__
+#define __MPSC_QUEUE_H__
+
+#include <atomic>
+#include <utility>
+
+/**
+    Unbounded lock-free multi-producer single-consumer FIFO.
+
+    push() may be called concurrently from any number of threads and is
+    wait-free (a single atomic exchange). pop() and empty() must only ever
+    be called from one consumer thread.
+
+    This is an intrusive linked list with a stub node (Dmitry Vyukov's
+    algorithm): the node at the tail is always a dummy whose value has
+    already been consumed.
+
+    @note A push that is in progress (its exchange has happened but the
+    link to the new node has not yet been published) is not visible to
+    the consumer until the link is stored.
+*/
+template <typename T>
+class MpscQueue {
+ public:
+  MpscQueue()
+      : m_head(new Node()), m_tail(m_head.load(std::memory_order_relaxed)) {}
+
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  virtual ~MpscQueue() {
+    T discard;
+    while (pop(discard)) {
+    }
+    delete m_tail;
+  }
+
+  void push(T&& item) {
+    Node* node = new Node(std::move(item));
+    Node* prev = m_head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  /// Consumer only: returns false if there is nothing to pop.
+  bool pop(T& item) {
+    Node* tail = m_tail;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      return false;
+    }
+
+    item   = std::move(next->value);
+    m_tail = next;
+    delete tail;
+    return true;
+  }
+
+  /// Consumer only.
+  bool empty() const { return m_tail->next.load(std::memory_order_acquire) == nullptr; }
+
+ private:
+  struct Node {
+    Node()
+        : next(nullptr) {}
+    explicit Node(T&& v)
+        : next(nullptr), value(std::move(v)) {}
+    std::atomic<Node*> next;
+    T value;
+  };
+
+  // Producers and consumer work on opposite ends so keep them on separate cache lines:
+  alignas(64) std::atomic<Node*> m_head;
+  alignas(64) Node* m_tail;
+};
+
+#endif /* __MPSC_QUEUE_H__ */
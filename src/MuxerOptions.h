@@ -0,0 +1,115 @@
+#ifndef MUXEROPTIONS_H
+#define MUXEROPTIONS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+/**
+    How the muxer's send thread shares the transport between
+    packet types that have packets waiting to be sent.
+*/
+enum class Scheduling : std::uint8_t {
+  Priority,  ///< Strict priority: all queued packets are sent before any lower priority or fair-share types.
+  FairShare  ///< Deficit round robin between all fair-share types, weighted by their byte quantum.
+};
+
+/**
+    What PacketMuxer::emplacePacket() does when a packet type's queue
+    (or the muxer's total byte budget) is full. Also used for subscriber
+    queues (see SubscriberOptions).
+
+    A packet that is larger than its type's maxBytes or the muxer's
+    maxQueuedBytes on its own can never fit, so with Block and DropOldest
+    it is discarded straight away: emplacePacket() returns false and the
+    drop is counted.
+*/
+enum class Overflow : std::uint8_t {
+  Block,       ///< Block the posting thread until there is space.
+  Fail,        ///< Reject the new packet: emplacePacket() returns false.
+  DropOldest,  ///< Accept the new packet and discard the oldest packets of the same type until it fits (but see MuxerOptions::maxQueuedBytes).
+  DropNewest   ///< Discard the new packet: emplacePacket() returns false and the drop is counted.
+};
+
+/**
+    Per packet type options for a PacketMuxer.
+*/
+struct ChannelOptions {
+  Scheduling scheduling = Scheduling::FairShare;
+
+  /// Priority types with a higher value are sent first:
+  int priority = 0;
+
+  /// Bytes credited to a fair-share type in each round. The share of the bandwidth
+  /// a type gets when the link is saturated is proportional to its quantum. It must
+  /// not be zero (PacketMuxer's constructor throws std::invalid_argument):
+  std::uint32_t quantum = 64 * 1024;
+
+  /// Limits on the number of packets and payload bytes queued for this type (zero for no limit):
+  std::size_t maxPackets = 0;
+  std::size_t maxBytes   = 0;
+  Overflow overflow      = Overflow::Block;
+
+  /// For state-like types where only the newest value matters: a newly posted packet
+  /// replaces any packet of the same type (and key, see PacketMuxer::emplaceKeyedPacket())
+  /// that is still waiting to be sent, keeping its place in the queue:
+  bool conflate = false;
+};
+
+/**
+    Options for configuring a PacketMuxer. These are fixed once the muxer is constructed.
+*/
+struct MuxerOptions {
+  /// Options for any packet type that is not listed in 'channels':
+  ChannelOptions defaults;
+
+  /// Options for specific packet types keyed by packet name:
+  std::unordered_map<std::string, ChannelOptions> channels;
+
+  /// Limit on the payload bytes queued for all types together (zero for no limit).
+  /// When it is reached each type's overflow policy applies, except that DropOldest
+  /// types only ever discard old packets to meet their own limits: a new packet that
+  /// does not fit the budget is discarded instead (like DropNewest):
+  std::size_t maxQueuedBytes = 0;
+
+  /// How long the send thread waits for a transport that will not accept any data before
+  /// giving up and reporting the peer as stalled (see PacketMuxer::stalled()). Zero waits forever:
+  std::chrono::milliseconds writeStallTimeout{0};
+
+  /// Payloads larger than this are sent as a sequence of fragments of at most this many
+  /// bytes so that other types can be interleaved with them: a large packet then only
+  /// delays higher priority types by one fragment. Zero sends every packet whole. The
+  /// receiving PacketDemuxer reassembles fragments before dispatch:
+  std::size_t maxFragmentSize = 0;
+
+  /// Write coalescing: when the delay is non-zero packets are held back so that more of
+  /// them are written (and end up in TCP segments) together. Queued packets are flushed as
+  /// soon as coalesceBytes of payload or coalescePackets packets are waiting, or the oldest
+  /// has waited for coalesceDelay, whichever comes first (zero thresholds are ignored):
+  std::chrono::microseconds coalesceDelay{0};
+  std::size_t coalesceBytes   = 0;
+  std::size_t coalescePackets = 0;
+
+  /// Cork the transport while each batch is written (see AbstractWriter::setCork())
+  /// so that a batch needing several writes still fills whole segments:
+  bool cork = false;
+
+  /// Time stamp packets when they are posted and record per type latency
+  /// histograms (see PacketMuxer::getQueueLatency() and getWriteLatency()):
+  bool latencyHistograms = false;
+
+  /// If false the muxer starts no send thread and is driven externally, by
+  /// PacketMuxer::flush() or a Reactor. Write coalescing is not applied in that case:
+  bool sendThread = true;
+
+  /// Let posting threads write a packet to the transport themselves when nothing
+  /// else is queued or being written, saving the hand off to the sending thread.
+  /// Whatever the transport does not accept immediately is left for the sending
+  /// thread (or driver), and packets that can not take the fast path are queued
+  /// as usual. Ignored when write coalescing is enabled:
+  bool inlineSend = false;
+};
+
+#endif  // MUXEROPTIONS_H
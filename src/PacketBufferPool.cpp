@@ -0,0 +1,109 @@
+#include "PacketBufferPool.h"
+
+#include <new>
+
+#include "ComPacket.h"
+
+namespace {
+
+/**
+    Allocator that takes memory for shared_ptr control blocks from a PacketBufferPool so
+    that std::allocate_shared can place a packet and its reference counts in one pooled block.
+*/
+template <typename T>
+class PoolAllocator {
+ public:
+  typedef T value_type;
+
+  explicit PoolAllocator(std::shared_ptr<PacketBufferPool> pool)
+      : m_pool(std::move(pool)) {}
+
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U>& other)
+      : m_pool(other.m_pool) {}
+
+  T* allocate(std::size_t n) { return static_cast<T*>(m_pool->allocate(n * sizeof(T))); }
+  void deallocate(T* p, std::size_t n) { m_pool->deallocate(p, n * sizeof(T)); }
+
+  template <typename U>
+  bool operator==(const PoolAllocator<U>& other) const { return m_pool == other.m_pool; }
+  template <typename U>
+  bool operator!=(const PoolAllocator<U>& other) const { return m_pool != other.m_pool; }
+
+  std::shared_ptr<PacketBufferPool> m_pool;
+};
+
+}  // namespace
+
+PooledBuffer::~PooledBuffer() {
+  if (m_data != nullptr) {
+    m_pool->deallocate(m_data, m_size);
+  }
+}
+
+PacketBufferPool::PacketBufferPool()
+    : m_heapAllocations(0) {
+}
+
+PacketBufferPool::~PacketBufferPool() {
+  for (std::size_t c = 0; c < NumSizeClasses; ++c) {
+    for (void* block : m_free[c]) {
+      ::operator delete(block);
+    }
+  }
+}
+
+/**
+    @return A buffer of exactly size bytes (the underlying block may be larger). The contents are uninitialised.
+*/
+PooledBuffer PacketBufferPool::allocateBuffer(std::size_t size) {
+  if (size == 0) {
+    return PooledBuffer();
+  }
+  return PooledBuffer(shared_from_this(), static_cast<VectorStream::CharType*>(allocate(size)), size);
+}
+
+/**
+    Move a packet into a new shared packet allocated from the pool.
+*/
+std::shared_ptr<ComPacket> PacketBufferPool::share(ComPacket&& packet) {
+  return std::allocate_shared<ComPacket>(PoolAllocator<ComPacket>(shared_from_this()), std::move(packet));
+}
+
+void* PacketBufferPool::allocate(std::size_t size) {
+  if (size <= MaxBlockSize) {
+    const std::size_t c = sizeClass(size);
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (m_free[c].empty() == false) {
+      void* block = m_free[c].back();
+      m_free[c].pop_back();
+      return block;
+    }
+    size = MinBlockSize << c;
+  }
+
+  m_heapAllocations += 1;
+  return ::operator new(size);
+}
+
+void PacketBufferPool::deallocate(void* block, std::size_t size) {
+  if (size <= MaxBlockSize) {
+    const std::size_t c         = sizeClass(size);
+    const std::size_t blockSize = MinBlockSize << c;
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (m_free[c].size() < 2 || (m_free[c].size() + 1) * blockSize <= MaxFreeBytesPerClass) {
+      m_free[c].push_back(block);
+      return;
+    }
+  }
+
+  ::operator delete(block);
+}
+
+std::size_t PacketBufferPool::sizeClass(std::size_t size) {
+  std::size_t c = 0;
+  while ((MinBlockSize << c) < size) {
+    c += 1;
+  }
+  return c;
+}
@@ -0,0 +1,96 @@
+#ifndef PACKETBUFFERPOOL_H
+#define PACKETBUFFERPOOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "VectorStream.h"
+
+class ComPacket;
+class PacketBufferPool;
+
+/**
+    Move-only handle to an uninitialised block of memory from a PacketBufferPool.
+    The memory is returned to the pool when the handle is destroyed.
+*/
+class PooledBuffer {
+ public:
+  PooledBuffer()
+      : m_data(nullptr), m_size(0) {}
+  PooledBuffer(const PooledBuffer&) = delete;
+  PooledBuffer& operator=(const PooledBuffer&) = delete;
+  PooledBuffer(PooledBuffer&& other)
+      : PooledBuffer() { swap(other); }
+  PooledBuffer& operator=(PooledBuffer&& other) {
+    swap(other);
+    return *this;
+  }
+  ~PooledBuffer();
+
+  VectorStream::CharType* data() const { return m_data; }
+  std::size_t size() const { return m_size; }
+
+ private:
+  friend class PacketBufferPool;
+  PooledBuffer(std::shared_ptr<PacketBufferPool> pool, VectorStream::CharType* data, std::size_t size)
+      : m_pool(std::move(pool)), m_data(data), m_size(size) {}
+
+  void swap(PooledBuffer& other) {
+    std::swap(m_pool, other.m_pool);
+    std::swap(m_data, other.m_data);
+    std::swap(m_size, other.m_size);
+  }
+
+  std::shared_ptr<PacketBufferPool> m_pool;
+  VectorStream::CharType* m_data;
+  std::size_t m_size;
+};
+
+/**
+    Thread safe pool of memory blocks in power of two size classes used to
+    hold received packets so that receiving does no heap allocation once
+    the pool has warmed up.
+
+    Both the payloads and the shared packets themselves (the ComPacket and
+    the shared_ptr control block are a single allocation) come from the pool.
+    Blocks are returned to the pool when the last reference to a packet is
+    released, which may happen on any thread.
+
+    Must be created using std::make_shared as outstanding buffers keep the
+    pool alive.
+*/
+class PacketBufferPool : public std::enable_shared_from_this<PacketBufferPool> {
+ public:
+  static constexpr std::size_t MinBlockSize   = 64;
+  static constexpr std::size_t NumSizeClasses = 15;  // 64 bytes to 1 MiB
+  static constexpr std::size_t MaxBlockSize   = MinBlockSize << (NumSizeClasses - 1);
+
+  /// Upper limit on the free memory kept for each size class (at least two blocks are always kept):
+  static constexpr std::size_t MaxFreeBytesPerClass = 4 * 1024 * 1024;
+
+  PacketBufferPool();
+  PacketBufferPool(const PacketBufferPool&) = delete;
+  virtual ~PacketBufferPool();
+
+  PooledBuffer allocateBuffer(std::size_t size);
+  std::shared_ptr<ComPacket> share(ComPacket&& packet);
+
+  void* allocate(std::size_t size);
+  void deallocate(void* block, std::size_t size);
+
+  /// Number of times the pool had to go to the heap (i.e. a request that could not be served from a free list):
+  std::uint64_t getNumHeapAllocations() const { return m_heapAllocations; }
+
+ private:
+  static std::size_t sizeClass(std::size_t size);
+
+  std::mutex m_lock;
+  std::vector<void*> m_free[NumSizeClasses];
+  std::atomic<std::uint64_t> m_heapAllocations;
+};
+
+#endif  // PACKETBUFFERPOOL_H
@@ -11,17 +11,34 @@
   #include <arpa/inet.h>
 #endif
 #include <assert.h>
+#include <string.h>
 
 /**
     Create a new demuxer that will receive packets from the specified socket.
 
     This object is guaranteed to only ever read from the socket.
 */
-PacketDemuxer::PacketDemuxer(AbstractReader& socket, const std::vector<std::string>& packetIds)
+PacketDemuxer::PacketDemuxer(AbstractReader& socket, const std::vector<std::string>& packetIds, const DemuxerOptions& options)
     : m_packetIds(packetIds),
+      m_subscribers(m_packetIds.size(), std::make_shared<const SubscriberList>()),
       m_transport(socket),
       m_transportError(false),
-      m_receiverThread(std::bind(&PacketDemuxer::receiveLoop, std::ref(*this))) {
+      m_rxBuffer(ReceiveBufferSize),
+      m_rxBegin(0),
+      m_rxEnd(0),
+      m_largeReceived(0),
+      m_largeMoreFragments(false),
+      m_skipBytes(0),
+      m_maxReassembledBytes(options.maxReassembledBytes),
+      m_counters(m_packetIds.size()),
+      m_numReads(0),
+      m_numBytesRead(0),
+      m_numUnknownPackets(0),
+      m_dispatchEpoch(0),
+      m_dispatchThread(std::thread::id()),
+      m_helloReceived(false),
+      m_pool(std::make_shared<PacketBufferPool>()),
+      m_receiverThread(options.receiveThread ? std::thread(&PacketDemuxer::receiveLoop, this) : std::thread()) {
   m_transport.setBlocking(false);
 }
 
@@ -31,10 +48,20 @@ PacketDemuxer::~PacketDemuxer() {
   // Check if there any remaining subscribers:
   warnAboutSubscribers();
 
-  try {
-    m_receiverThread.join();
-  } catch (const std::system_error& e) {
-    std::clog << "Error: " << e.what() << std::endl;
+  if (m_receiverThread.joinable()) {
+    try {
+      m_receiverThread.join();
+    } catch (const std::system_error& e) {
+      std::clog << "Error: " << e.what() << std::endl;
+    }
+  }
+
+  // Stop the worker threads of any subscribers that are still subscribed:
+  for (const SubscriberSnapshot& queue : m_subscribers) {
+    for (const SubscriberPtr& subscriber : *std::atomic_load(&queue)) {
+      subscriber->requestStop();
+      subscriber->joinWorker();
+    }
   }
 }
 
@@ -51,32 +78,84 @@ bool PacketDemuxer::ok() const {
  *  Returns a subscription object that will automatically unsubsribe
  *  (and deregister the callback) when it goes out of scope.
 */
-PacketSubscription PacketDemuxer::subscribe(const std::string& typeName, PacketSubscriber::CallBack callback) {
-  const IdManager::PacketType type = m_packetIds.toId(typeName);
+PacketSubscription PacketDemuxer::subscribe(std::string_view typeName, PacketSubscriber::CallBack callback,
+                                            const SubscriberOptions& options) {
+  return subscribeId(m_packetIds.toId(typeName), std::move(callback), options);
+}
+
+PacketSubscription PacketDemuxer::subscribeId(IdManager::PacketType type, PacketSubscriber::CallBack callback,
+                                              const SubscriberOptions& options) {
+  return addSubscriber(SubscriberPtr(new PacketSubscriber(type, *this, callback, options)));  /// @note Can't use make_shared because of protected constructor.
+}
 
-  std::lock_guard<std::mutex> guard(m_subscriberLock);
-  SubscriptionEntry::second_type& queue = m_subscribers[type];
-  queue.emplace_back(new PacketSubscriber(type, *this, callback));  /// @note Can't use make_shared because of protected constructor.
+/**
+    Subscribe with a callback that receives packets in batches: all packets of
+    the type that arrived in one burst of reads from the transport (i.e. until
+    no complete packet is left in the receive buffer), split into smaller
+    batches if options.maxBatch or options.maxBatchDelay are set. This saves
+    a callback per packet for high rate types and lets the subscriber process
+    packets together. Batch callbacks are called on the receive thread
+    (options.queueLength must be zero) and may be mixed with per packet
+    subscribers of the same type.
+*/
+PacketSubscription PacketDemuxer::subscribeBatch(std::string_view typeName, PacketSubscriber::BatchCallBack callback,
+                                                 const SubscriberOptions& options) {
+  return addSubscriber(SubscriberPtr(new PacketSubscriber(m_packetIds.toId(typeName), *this, callback, options)));
+}
+
+PacketSubscription PacketDemuxer::addSubscriber(SubscriberPtr subscriber) {
+  const IdManager::PacketType type = subscriber->getType();
+  assert(type < m_packetIds.size());
+
+  subscriber->startWorker(subscriber);
+  {
+    std::lock_guard<std::mutex> guard(m_subscriberLock);
+    auto queue = std::make_shared<SubscriberList>(*std::atomic_load(&m_subscribers[type]));
+    queue->push_back(subscriber);
+    std::atomic_store(&m_subscribers[type], SubscriberSnapshot(std::move(queue)));
+  }
 
-  std::clog << "New subscriber for '" << typeName << "'" << std::endl;
+  std::clog << "New subscriber for '" << m_packetIds.toString(type) << "'" << std::endl;
 
-  return PacketSubscription(queue.back());
+  return PacketSubscription(subscriber);
 }
 
+/**
+    Once this returns the subscriber's callback will not be called again. If it
+    is called from a callback (on the receiving thread) other subscribers of the
+    packet being dispatched may still receive that packet. Packets still queued
+    for a subscriber with a queue are discarded.
+*/
 void PacketDemuxer::unsubscribe(const PacketSubscriber* pSubscriber) {
   const IdManager::PacketType type = pSubscriber->getType();
-  std::clog << "Removing subscriber for '" << m_packetIds.toString(type) << "'" << std::endl;
+  SubscriberPtr removed;
+  {
+    std::lock_guard<std::mutex> guard(m_subscriberLock);
+    const SubscriberSnapshot current = std::atomic_load(&m_subscribers[type]);
+
+    // Copy all subscribers of this type except the specific subscriber:
+    auto queue = std::make_shared<SubscriberList>();
+    queue->reserve(current->size());
+    for (const SubscriberPtr& subscriber : *current) {
+      if (subscriber.get() == pSubscriber) {
+        removed = subscriber;
+      } else {
+        queue->push_back(subscriber);
+      }
+    }
 
-  std::lock_guard<std::mutex> guard(m_subscriberLock);
-  SubscriptionEntry::second_type& queue = m_subscribers[type];
+    if (removed == nullptr) {
+      return;  // Already removed
+    }
+    std::atomic_store(&m_subscribers[type], SubscriberSnapshot(std::move(queue)));
+  }
 
-  // Search through all subscribers of this type for the specific subscriber:
-  auto itr = std::remove_if(queue.begin(), queue.end(), [pSubscriber](const PacketDemuxer::SubscriberPtr& subscriber) {
-    return subscriber.get() == pSubscriber;
-  });
+  std::clog << "Removing subscriber for '" << m_packetIds.toString(type) << "'" << std::endl;
 
-  assert(itr != queue.end());
-  queue.erase(itr);
+  // Stop the worker first so a dispatch blocked on its full queue can finish:
+  removed->requestStop();
+  waitForDispatch();
+  removed->joinWorker();
 }
 
 /**
@@ -84,20 +163,87 @@ void PacketDemuxer::unsubscribe(const PacketSubscriber* pSubscriber) {
 */
 bool PacketDemuxer::isSubscribed(const PacketSubscriber* pSubscriber) const {
   const IdManager::PacketType type = pSubscriber->getType();
-  auto queueItr                    = m_subscribers.find(type);
-
-  if (queueItr == m_subscribers.end()) {
+  if (type >= m_subscribers.size()) {
     return false;
   }
 
-  const SubscriptionEntry::second_type& queue = queueItr->second;
+  const SubscriberSnapshot queue = std::atomic_load(&m_subscribers[type]);
 
   // Search through all subscribers of this type for the specific subscriber:
-  auto itr = std::find_if(queue.begin(), queue.end(), [pSubscriber](const PacketDemuxer::SubscriberPtr& subscriber) {
+  auto itr = std::find_if(queue->begin(), queue->end(), [pSubscriber](const PacketDemuxer::SubscriberPtr& subscriber) {
     return subscriber.get() == pSubscriber;
   });
 
-  return itr != queue.end();
+  return itr != queue->end();
+}
+
+/**
+    Call the subscribers for the packet's type. No lock is held while the
+    callbacks run: the subscriber list is an immutable snapshot that changes
+    to subscriptions replace rather than modify, so callbacks may subscribe
+    and unsubscribe, and other threads can do so without waiting for slow
+    callbacks (unsubscribe() only waits for a dispatch already in progress).
+*/
+void PacketDemuxer::dispatch(IdManager::PacketType type, const ComPacket::ConstSharedPacket& sptr) {
+  m_dispatchThread = std::this_thread::get_id();
+  m_dispatchEpoch += 1;  // Odd while dispatching
+  const SubscriberSnapshot queue = std::atomic_load(&m_subscribers[type]);
+  //std::clog << "Posting '" << m_packetIds.toString(type) << "' to " << queue->size() << " subscribers" << std::endl;
+  for (const auto& subscriber : *queue) {
+    if (subscriber->deliver(sptr)) {
+      m_pendingBatches.push_back(subscriber);
+    }
+  }
+  m_dispatchEpoch += 1;
+}
+
+/**
+    Deliver the packets collected by batch subscribers. Called at the end of
+    each read burst.
+*/
+void PacketDemuxer::deliverBatches() {
+  if (m_pendingBatches.empty()) {
+    return;
+  }
+
+  m_dispatchThread = std::this_thread::get_id();
+  m_dispatchEpoch += 1;
+  for (const auto& subscriber : m_pendingBatches) {
+    subscriber->deliverBatch();
+  }
+  m_dispatchEpoch += 1;
+  m_pendingBatches.clear();
+}
+
+/**
+    @return true if a complete frame is waiting in the receive buffer, i.e. the
+    next frame can be parsed without reading from the transport.
+*/
+bool PacketDemuxer::frameBuffered() const {
+  if (m_skipBytes > 0 || m_rxEnd - m_rxBegin < FrameHeaderSize) {
+    return false;
+  }
+
+  uint32_t size = 0;
+  memcpy(&size, &m_rxBuffer[m_rxBegin + sizeof(uint32_t)], sizeof(uint32_t));
+  return m_rxEnd - m_rxBegin >= FrameHeaderSize + ntohl(size);
+}
+
+/**
+    Wait until any dispatch that may have loaded an old subscriber list has
+    finished. Returns immediately on the dispatching thread (i.e. in a callback).
+*/
+void PacketDemuxer::waitForDispatch() const {
+  if (std::this_thread::get_id() == m_dispatchThread.load()) {
+    return;
+  }
+
+  const std::uint64_t epoch = m_dispatchEpoch;
+  if (epoch % 2 == 1) {
+    while (m_dispatchEpoch == epoch) {
+      std::this_thread::yield();
+    }
+  }
 }
 
 /**
@@ -117,23 +263,11 @@ void PacketDemuxer::receiveLoop() {
   while (m_transportError == false) {
     constexpr int timeoutInMilliseconds = 1000;
     if (receivePacket(packet, timeoutInMilliseconds)) {
-      const IdManager::PacketType packetType = packet.getType();  // Need to cache this before we use std::move
-      //std::clog << GetIdManager().toString( packetType ) << " bytes: " << packet.getDataSize() << std::endl;
-      auto sptr = std::make_shared<ComPacket>(std::move(packet));
-
-      if (packetType == IdManager::ControlPacket) {
-        // Control messages are used by the muxer to communicate
-        // with the demuxer (this is a one way protocol).
-        handleControlMessage(sptr);
-      } else {
-        // Post the new packet to the message queues of all the subscribers for this packet type:
-        std::lock_guard<std::mutex> guard(m_subscriberLock);
-        SubscriptionEntry::second_type& queue = m_subscribers[packetType];
-        //std::clog << "Posting '" << m_packetIds.toString(packetType) << "' to " << queue.size() << " subscribers" << std::endl;
-        for (auto& subscriber : queue) {
-          subscriber->m_callback(sptr);
-        }
-      }
+      handlePacket(packet);
+    }
+
+    if (frameBuffered() == false) {
+      deliverBatches();
     }
   }
 
@@ -141,85 +275,411 @@ void PacketDemuxer::receiveLoop() {
 }
 
 /**
+    Receive and dispatch packets on the calling thread, for demuxers constructed
+    without a receive thread (see DemuxerOptions::receiveThread). Waits for up to
+    timeoutInMilliseconds (negative waits indefinitely, zero not at all) for the
+    first packet and then takes at most maxPackets that are already available.
+    Subscriber callbacks (and batch deliveries) are called before this returns.
+    If maxPackets is zero nothing is read and zero is returned immediately.
+
+    @return Number of packets received (including control packets), zero on timeout or transport error.
+*/
+std::size_t PacketDemuxer::poll(std::size_t maxPackets, int timeoutInMilliseconds) {
+  assert(m_receiverThread.joinable() == false);
+  if (maxPackets == 0) {
+    return 0;
+  }
+
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutInMilliseconds);
+  std::size_t count   = receiveAvailable(maxPackets);
+  while (count == 0 && timeoutInMilliseconds != 0 && m_transportError == false) {
+    int wait = -1;
+    if (timeoutInMilliseconds > 0) {
+      const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+      if (remaining.count() <= 0) {
+        break;
+      }
+      wait = static_cast<int>(remaining.count());
+    }
+
+    if (m_transport.readyForReading(wait) == false) {
+      break;
+    }
+
+    const std::uint64_t bytesRead = m_numBytesRead;
+    count                         = receiveAvailable(maxPackets);
+    if (count == 0 && m_numBytesRead == bytesRead) {
+      // Readable but nothing to read means the peer has closed the connection:
+      std::clog << "Signalling transport error because the transport was closed." << std::endl;
+      signalTransportError();
+    }
+  }
+
+  return count;
+}
+
+/**
+    Receive and dispatch the packets that can be received without waiting,
+    up to a maximum of maxPackets. This is the receive loop of a demuxer
+    without a receive thread, called by its driver when the transport is
+    readable. Payloads too large for the receive buffer are still read to
+    completion once started.
+
+    @return Number of packets received (including control packets).
+*/
+std::size_t PacketDemuxer::receiveAvailable(std::size_t maxPackets) {
+  std::size_t count = 0;
+  ComPacket packet;
+  while (count < maxPackets && m_transportError == false && receivePacket(packet, 0)) {
+    if (m_helloReceived) {
+      handlePacket(packet);
+    } else {
+      checkHelloMessage(packet);
+    }
+    count += 1;
+  }
+
+  if (frameBuffered() == false) {
+    deliverBatches();
+  }
+  return count;
+}
+
+/**
+    Pass a received packet on to the control message handler or the subscribers.
+*/
+void PacketDemuxer::handlePacket(ComPacket& packet) {
+  const IdManager::PacketType packetType = packet.getType();  // Need to cache this before we use std::move
+  //std::clog << GetIdManager().toString( packetType ) << " bytes: " << packet.getDataSize() << std::endl;
+  ComPacket::ConstSharedPacket sptr = m_pool->share(std::move(packet));
+
+  if (packetType == IdManager::ControlPacket) {
+    // Control messages are used by the muxer to communicate
+    // with the demuxer (this is a one way protocol).
+    handleControlMessage(sptr);
+  } else {
+    // Post the new packet to all the subscribers for this packet type:
+    dispatch(packetType, sptr);
+  }
+}
+
+/**
+    Receive the next complete packet. Fragments (see MuxerOptions::maxFragmentSize)
+    are accumulated per type in a pooled buffer and the packet is returned once its
+    last fragment has arrived (packets over DemuxerOptions::maxReassembledBytes are
+    discarded). Fragments of other types may be interleaved with them. Packets
+    with type IDs outside this demuxer's packet list are discarded (and counted).
+
     @param packet If return value is true then packet will contain the new data, if false packet remains unchanged.
-    @return false on comms error, true if successful.
+    @return false on comms error or timeout, true if successful.
 */
 bool PacketDemuxer::receivePacket(ComPacket& packet, const int timeoutInMilliseconds) {
-  if (m_transport.readyForReading(timeoutInMilliseconds) == false) {
-    return false;
+  ComPacket frame;
+  bool moreFragments = false;
+  while (receiveFrame(frame, moreFragments, timeoutInMilliseconds)) {
+    const IdManager::PacketType type = frame.getType();
+    auto itr = m_fragments.find(type);
+    if (moreFragments == false && itr == m_fragments.end()) {
+      countPacket(frame);
+      std::swap(frame, packet);
+      return true;
+    }
+
+    if (itr == m_fragments.end()) {
+      itr = m_fragments.emplace(type, Reassembly()).first;
+    }
+    Reassembly& reassembly = itr->second;
+    const std::size_t size = reassembly.size + frame.getDataSize();
+    if (m_maxReassembledBytes > 0 && size > m_maxReassembledBytes) {
+      reassembly.discarding = true;
+      reassembly.buffer     = PooledBuffer();
+    }
+
+    if (reassembly.discarding) {
+      if (moreFragments == false) {
+        m_fragments.erase(itr);
+        m_numUnknownPackets += 1;
+      }
+      continue;
+    }
+
+    // Grow geometrically so a packet of n fragments is copied O(log n) times:
+    if (size > reassembly.buffer.size()) {
+      PooledBuffer grown = m_pool->allocateBuffer(std::max(size, 2 * reassembly.buffer.size()));
+      if (reassembly.size > 0) {
+        memcpy(grown.data(), reassembly.buffer.data(), reassembly.size);
+      }
+      reassembly.buffer = std::move(grown);
+    }
+    if (frame.getDataSize() > 0) {
+      memcpy(reassembly.buffer.data() + reassembly.size, frame.getDataPtr(), frame.getDataSize());
+    }
+    reassembly.size = size;
+
+    if (moreFragments == false) {
+      packet = ComPacket(type, std::move(reassembly.buffer), reassembly.size);
+      m_fragments.erase(itr);
+      countPacket(packet);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+    Frames are parsed out of an internal receive buffer which is filled with
+    large reads from the transport, so a burst of small packets costs far fewer
+    than one system call per packet. Only payloads too large for the receive
+    buffer are read directly into the packet. Payloads are allocated from the
+    demuxer's buffer pool and are not zero-filled.
+
+    If the timeout expires part way through a packet the bytes received so far
+    remain buffered (or, for a payload too large for the receive buffer, in the
+    partially received packet) and the packet is completed by a subsequent call.
+
+    Frames with an invalid type or a type outside this demuxer's packet list
+    (e.g. the muxer was built from a newer packet list) are checked from the
+    header alone: their payloads are skipped without being allocated and they
+    are counted as unknown packets.
+
+    @param packet If return value is true then packet will contain the new data, if false packet remains unchanged.
+    @param moreFragments Set to true if the frame is a fragment and more fragments of its type follow.
+    @return false on comms error, true if successful.
+*/
+bool PacketDemuxer::receiveFrame(ComPacket& packet, bool& moreFragments, const int timeoutInMilliseconds) {
+  if (m_largeFrame.getType() != IdManager::InvalidPacket) {
+    return receiveLargeFrame(packet, moreFragments, timeoutInMilliseconds);
   }
 
   uint32_t type = 0;
   uint32_t size = 0;
+  for (;;) {
+    if (skipPayload(timeoutInMilliseconds) == false ||
+        fillReceiveBuffer(FrameHeaderSize, timeoutInMilliseconds) == false) {
+      return false;
+    }
 
-  // For the first read we generate a transport error on zero bytes
-  // (because readyForReading() said there were bytes available):
-  ///@note - the above is incorrect as ReadyForReading uses POLLIN which
-  /// also returns true if there is out of band data ready for reading.
-  size_t byteCount = sizeof(uint32_t);
-  bool ok          = readBytes(reinterpret_cast<uint8_t*>(&type), byteCount, false);
-  if (!ok) {
-    return false;
-  }
+    memcpy(&type, &m_rxBuffer[m_rxBegin], sizeof(uint32_t));
+    memcpy(&size, &m_rxBuffer[m_rxBegin + sizeof(uint32_t)], sizeof(uint32_t));
+    type          = ntohl(type);
+    size          = ntohl(size);
+    moreFragments = (type & MoreFragmentsFlag) != 0;
+    type &= ~MoreFragmentsFlag;
 
-  byteCount = sizeof(uint32_t);
-  ok        = readBytes(reinterpret_cast<uint8_t*>(&size), byteCount);
-  if (!ok) {
-    return false;
+    if (type != IdManager::InvalidPacket && type < m_subscribers.size()) {
+      break;
+    }
+
+    if (moreFragments == false) {
+      m_numUnknownPackets += 1;
+    }
+    m_rxBegin += FrameHeaderSize;
+    m_skipBytes = size;
   }
 
-  type = ntohl(type);
-  size = ntohl(size);
+  if (FrameHeaderSize + size <= ReceiveBufferSize) {
+    if (fillReceiveBuffer(FrameHeaderSize + size, timeoutInMilliseconds) == false) {
+      return false;
+    }
 
-  ComPacket p(static_cast<IdManager::PacketType>(type), size);
-  byteCount = p.getDataSize();
-  ok        = readBytes(reinterpret_cast<uint8_t*>(p.getDataPtr()), byteCount);
-  if (!ok) {
-    return false;
+    const auto* payload = reinterpret_cast<const VectorStream::CharType*>(&m_rxBuffer[m_rxBegin + FrameHeaderSize]);
+    if (ComPacket::fitsInline(size)) {
+      packet = ComPacket(static_cast<IdManager::PacketType>(type), payload, static_cast<int>(size));
+    } else {
+      ComPacket p(static_cast<IdManager::PacketType>(type), m_pool->allocateBuffer(size));
+      memcpy(p.getDataPtr(), payload, size);
+      std::swap(p, packet);
+    }
+    m_rxBegin += FrameHeaderSize + size;
+  } else {
+    // Payload does not fit in the receive buffer so take whatever
+    // is already buffered and then read the rest in place:
+    m_largeFrame = ComPacket(static_cast<IdManager::PacketType>(type), m_pool->allocateBuffer(size));
+    m_largeMoreFragments = moreFragments;
+    m_rxBegin += FrameHeaderSize;
+    m_largeReceived = m_rxEnd - m_rxBegin;
+    memcpy(m_largeFrame.getDataPtr(), &m_rxBuffer[m_rxBegin], m_largeReceived);
+    m_rxBegin = m_rxEnd = 0;
+    return receiveLargeFrame(packet, moreFragments, timeoutInMilliseconds);
   }
 
-  std::swap(p, packet);
   assert(packet.getType() != IdManager::InvalidPacket);  // Catch invalid packets at the lowest level.
 
   return true;
 }
 
 /**
-    Loop to guarantee the number of bytes requested are actually read.
+    Discard the payload bytes of a rejected frame, reading them from the
+    transport as needed.
+
+    @return true once the whole payload has been discarded.
+*/
+bool PacketDemuxer::skipPayload(const int timeoutInMilliseconds) {
+  while (m_skipBytes > 0) {
+    if (m_rxBegin == m_rxEnd) {
+      m_rxBegin = m_rxEnd = 0;
+      if (fillReceiveBuffer(1, timeoutInMilliseconds) == false) {
+        return false;
+      }
+    }
+
+    const std::size_t n = std::min(m_skipBytes, m_rxEnd - m_rxBegin);
+    m_rxBegin += n;
+    m_skipBytes -= n;
+  }
+
+  return true;
+}
+
+/**
+    Read the rest of a payload too large for the receive buffer directly into
+    its packet. The bytes received so far are kept if the transport runs dry
+    or the timeout expires, so an externally driven demuxer never waits for
+    the rest of the payload to arrive.
+
+    @return true once the whole payload has been received.
+*/
+bool PacketDemuxer::receiveLargeFrame(ComPacket& packet, bool& moreFragments, const int timeoutInMilliseconds) {
+  uint8_t* dest         = reinterpret_cast<uint8_t*>(m_largeFrame.getDataPtr());
+  std::size_t remaining = m_largeFrame.getDataSize() - m_largeReceived;
+  const bool complete   = readBytes(dest + m_largeReceived, remaining, timeoutInMilliseconds);
+  m_largeReceived       = m_largeFrame.getDataSize() - remaining;
+  if (complete == false) {
+    return false;
+  }
+
+  moreFragments = m_largeMoreFragments;
+  std::swap(m_largeFrame, packet);
+  m_largeFrame    = ComPacket();
+  m_largeReceived = 0;
+  assert(packet.getType() != IdManager::InvalidPacket);
+  return true;
+}
+
+/**
+    Read from the transport until at least minBytes are held in the receive buffer.
+
+    Reads are always attempted before waiting on the transport so that data which
+    is already available costs no extra poll.
 
-    On error (return of false) size will contain the number of bytes that were remaining to be read.
+    @return true if the bytes are available, false on timeout or transport error.
+*/
+bool PacketDemuxer::fillReceiveBuffer(std::size_t minBytes, const int timeoutInMilliseconds) {
+  assert(minBytes <= ReceiveBufferSize);
 
-    @param transportErrorOnZeroBytes If this is true then in the case that read() returns zero bytes
-    a transport error will be signalled and ReadBytes() will return false.
+  bool readable = false;
+  while (m_rxEnd - m_rxBegin < minBytes) {
+    if (m_transportError) {
+      return false;
+    }
+
+    // Move any partial packet to the front to make space:
+    if (m_rxBegin > 0 && m_rxBegin + minBytes > ReceiveBufferSize) {
+      std::copy(m_rxBuffer.begin() + m_rxBegin, m_rxBuffer.begin() + m_rxEnd, m_rxBuffer.begin());
+      m_rxEnd -= m_rxBegin;
+      m_rxBegin = 0;
+    }
 
-    @return true if all bytes were written, false if there was an error at any point. Also see impact
-    of the transportErrorOnZeroBytes parameter on the return value.
+    // Readable but no bytes means the peer has closed the transport:
+    const int n = m_transport.read(reinterpret_cast<char*>(&m_rxBuffer[m_rxEnd]), ReceiveBufferSize - m_rxEnd);
+    if (n < 0 || (n == 0 && readable)) {
+      std::clog << "Signalling transport error because bytes read := " << n << std::endl;
+      signalTransportError();
+      return false;
+    }
+
+    // With a zero timeout this only checks whether the transport is readable (e.g. closed):
+    if (n == 0) {
+      if (m_transport.readyForReading(timeoutInMilliseconds) == false) {
+        return false;
+      }
+      readable = true;
+      continue;
+    }
+
+    readable = false;
+    countRead(n);
+    m_rxEnd += n;
+  }
+
+  return true;
+}
+
+/**
+    Read until the number of bytes requested have been read, the transport
+    runs dry and the timeout expires (zero does not wait) or there is an error.
+
+    A transport that reports being readable but then returns no bytes has
+    been closed by the peer and a transport error is signalled. This is
+    checked with a zero timeout too, so callers that only poll see it.
+
+    @param size The number of bytes to read. On return it holds the number of bytes still to be read.
+    @return true if all bytes were read, false on timeout or error.
 */
-bool PacketDemuxer::readBytes(uint8_t* buffer, size_t& size, bool transportErrorOnZeroBytes) {
+bool PacketDemuxer::readBytes(uint8_t* buffer, std::size_t& size, const int timeoutInMilliseconds) {
+  bool readable = false;
   while (size > 0 && m_transportError == false) {
     const int n = m_transport.read(reinterpret_cast<char*>(buffer), size);
 
-    if (n < 0 || (n == 0 && transportErrorOnZeroBytes)) {
+    if (n < 0 || (n == 0 && readable)) {
       std::clog << "Signalling transport error because bytes read := " << n << std::endl;
       signalTransportError();
       return false;
     }
 
+    if (n == 0) {
+      if (m_transport.readyForReading(timeoutInMilliseconds) == false) {
+        return false;
+      }
+      readable = true;
+      continue;
+    }
+
+    readable = false;
+    countRead(n);
     size -= n;
     buffer += n;
   }
 
-  if (m_transportError) {
-    return false;
-  }
-
-  return true;
+  return m_transportError == false;
 }
 
 void PacketDemuxer::signalTransportError() {
   m_transportError = true;
 }
 
+void PacketDemuxer::countRead(int bytes) {
+  if (bytes > 0) {
+    m_numReads += 1;
+    m_numBytesRead += bytes;
+  }
+}
+
+void PacketDemuxer::countPacket(const ComPacket& packet) {
+  RxCounters& counters = m_counters[packet.getType()];
+  counters.packets += 1;
+  counters.bytes += packet.getDataSize();
+}
+
+/**
+    Take a snapshot of the demuxer's statistics. This is cheap enough to
+    call at any time from any thread and does not block receiving.
+*/
+DemuxerStats PacketDemuxer::getStats() const {
+  DemuxerStats stats;
+  stats.types.resize(m_counters.size());
+  for (std::size_t type = 0; type < m_counters.size(); ++type) {
+    stats.types[type].name    = m_packetIds.toString(type);
+    stats.types[type].packets = m_counters[type].packets;
+    stats.types[type].bytes   = m_counters[type].bytes;
+  }
+  stats.reads          = m_numReads;
+  stats.bytesRead      = m_numBytesRead;
+  stats.unknownPackets = m_numUnknownPackets;
+  return stats;
+}
+
 /**
     Receive the hello message. The first packet sent from a PacketMuxer to
     a demuxer will always be an Hello control message. If the first message
@@ -234,22 +694,27 @@ void PacketDemuxer::signalTransportError() {
 */
 void PacketDemuxer::receiveHelloMessage(ComPacket& packet, const int timeoutInMillisecs) {
   if (receivePacket(packet, timeoutInMillisecs)) {
-    bool failHard = true;
-
-    // Very first packet should be a 'Hello' control packet:
-    if (packet.getType() == IdManager::ControlPacket) {
-      auto sptr          = std::make_shared<ComPacket>(std::move(packet));
-      ControlMessage msg = getControlMessage(sptr);
-      if (msg == ControlMessage::Hello) {
-        failHard = false;
-      }
-    }
+    checkHelloMessage(packet);
+  }
+}
 
-    if (failHard) {
-      std::cerr << "Error in PacketDemuxer::Receive() - first message was not 'Hello'." << std::endl;
-      signalTransportError();
+void PacketDemuxer::checkHelloMessage(ComPacket& packet) {
+  bool failHard = true;
+
+  // Very first packet should be a 'Hello' control packet:
+  if (packet.getType() == IdManager::ControlPacket) {
+    auto sptr          = std::make_shared<ComPacket>(std::move(packet));
+    ControlMessage msg = getControlMessage(sptr);
+    if (msg == ControlMessage::Hello) {
+      failHard = false;
     }
   }
+
+  if (failHard) {
+    std::cerr << "Error in PacketDemuxer::Receive() - first message was not 'Hello'." << std::endl;
+    signalTransportError();
+  }
+  m_helloReceived = true;
 }
 
 void PacketDemuxer::handleControlMessage(const ComPacket::ConstSharedPacket&) {
@@ -262,11 +727,10 @@ ControlMessage PacketDemuxer::getControlMessage(const ComPacket::ConstSharedPack
 }
 
 void PacketDemuxer::warnAboutSubscribers() {
-  std::lock_guard<std::mutex> guard(m_subscriberLock);
-  for (const auto& entry : m_subscribers) {
-    const size_t n = entry.second.size();
+  for (std::size_t type = 0; type < m_subscribers.size(); ++type) {
+    const size_t n = std::atomic_load(&m_subscribers[type])->size();
     if (n > 0) {
-      std::clog << "Warning: there are " << n << " live subscribers for '" << m_packetIds.toString(entry.first) << "'" << std::endl;
+      std::clog << "Warning: there are " << n << " live subscribers for '" << m_packetIds.toString(type) << "'" << std::endl;
     }
   }
 }
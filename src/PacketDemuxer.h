@@ -4,17 +4,26 @@
 #ifndef __PACKET_DEMUXER_H__
 #define __PACKET_DEMUXER_H__
 
+#include <atomic>
 #include <initializer_list>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
+#include "Channel.h"
 #include "ComPacket.h"
 #include "ControlMessage.h"
+#include "DemuxerOptions.h"
 #include "IdManager.h"
+#include "PacketBufferPool.h"
+#include "PacketStats.h"
 #include "PacketSubscriber.h"
 #include "PacketSubscription.h"
+#include "SubscriberOptions.h"
 #include "network/AbstractSocket.h"
 
 /**
@@ -30,44 +39,141 @@
 
     The demuxing reads packets from the transport layer and then sends
     these packets onto any subscribers registered for the packet type.
+    Packets that the muxer split into fragments are reassembled first.
+
+    Normally the demuxer owns a receive thread. Alternatively (DemuxerOptions::receiveThread)
+    it can be driven externally: either the application calls poll() from its own loop, so
+    packets are dispatched on that thread with no hand off, or one thread services many
+    demuxers (see Reactor).
 
     The data itself is currently sent as byte stream over TCP.
 */
 class PacketDemuxer {
+  friend class Reactor;
+
  public:
   typedef std::shared_ptr<PacketSubscriber> SubscriberPtr;
 
-  PacketDemuxer(AbstractReader& socket, const std::vector<std::string>& packetIds);
+  PacketDemuxer(AbstractReader& socket, const std::vector<std::string>& packetIds, const DemuxerOptions& options = DemuxerOptions());
   virtual ~PacketDemuxer();
 
   bool ok() const;
 
-  PacketSubscription subscribe(const std::string& type, PacketSubscriber::CallBack callback);
+  PacketSubscription subscribe(std::string_view type, PacketSubscriber::CallBack callback,
+                               const SubscriberOptions& options = SubscriberOptions());
+
+  template <typename T>
+  PacketSubscription subscribe(Channel<T> channel, PacketSubscriber::CallBack callback,
+                               const SubscriberOptions& options = SubscriberOptions()) {
+    return subscribeId(channel.id(), std::move(callback), options);
+  }
+
+  PacketSubscription subscribeBatch(std::string_view type, PacketSubscriber::BatchCallBack callback,
+                                    const SubscriberOptions& options = SubscriberOptions());
+
+  template <typename T>
+  PacketSubscription subscribeBatch(Channel<T> channel, PacketSubscriber::BatchCallBack callback,
+                                    const SubscriberOptions& options = SubscriberOptions()) {
+    return addSubscriber(SubscriberPtr(new PacketSubscriber(channel.id(), *this, callback, options)));
+  }
+
   void unsubscribe(const PacketSubscriber* subscriber);
   bool isSubscribed(const PacketSubscriber* subscriber) const;
 
+  std::size_t poll(std::size_t maxPackets, int timeoutInMilliseconds);
+
   void receiveLoop();
   bool receivePacket(ComPacket& packet, const int timeoutInMilliseconds);
 
   const IdManager& getIdManager() const { return m_packetIds; }
+  const PacketBufferPool& getBufferPool() const { return *m_pool; }
+  DemuxerStats getStats() const;
 
  protected:
-  typedef std::pair<IdManager::PacketType, std::vector<SubscriberPtr> > SubscriptionEntry;
-
-  bool readBytes(uint8_t* buffer, size_t& size, bool transportErrorOnZeroBytes = false);
+  typedef std::vector<SubscriberPtr> SubscriberList;
+  typedef std::shared_ptr<const SubscriberList> SubscriberSnapshot;
+
+  PacketSubscription subscribeId(IdManager::PacketType type, PacketSubscriber::CallBack callback, const SubscriberOptions& options);
+  PacketSubscription addSubscriber(SubscriberPtr subscriber);
+  bool readBytes(uint8_t* buffer, std::size_t& size, const int timeoutInMilliseconds);
+  bool receiveFrame(ComPacket& frame, bool& moreFragments, const int timeoutInMilliseconds);
+  bool receiveLargeFrame(ComPacket& frame, bool& moreFragments, const int timeoutInMilliseconds);
+  bool skipPayload(const int timeoutInMilliseconds);
+  bool fillReceiveBuffer(std::size_t minBytes, const int timeoutInMilliseconds);
   void signalTransportError();
+  void countRead(int bytes);
+  void countPacket(const ComPacket& packet);
+  std::size_t receiveAvailable(std::size_t maxPackets);
+  void handlePacket(ComPacket& packet);
+  void dispatch(IdManager::PacketType type, const ComPacket::ConstSharedPacket& sptr);
+  void deliverBatches();
+  bool frameBuffered() const;
+  void waitForDispatch() const;
 
  private:
+  /// Totals for one packet type (written by the receiving thread, read from any thread):
+  struct RxCounters {
+    std::atomic<std::uint64_t> packets{0};
+    std::atomic<std::uint64_t> bytes{0};
+  };
+
   IdManager m_packetIds;
+  // Subscriber lists indexed by packet type ID. Each list is immutable once
+  // published and is only replaced, using std::atomic_load/atomic_store. The
+  // lock only serialises changes:
   std::mutex m_subscriberLock;
-  std::unordered_map<SubscriptionEntry::first_type, SubscriptionEntry::second_type> m_subscribers;
+  std::vector<SubscriberSnapshot> m_subscribers;
   AbstractReader& m_transport;
-  bool m_transportError;
+  std::atomic<bool> m_transportError;
+
+  // Bytes read from the transport but not yet parsed into packets. Only
+  // accessed from the receiving thread. Valid data is [m_rxBegin, m_rxEnd):
+  static constexpr std::size_t FrameHeaderSize   = 2 * sizeof(uint32_t);
+  static constexpr std::size_t ReceiveBufferSize = 64 * 1024;
+  std::vector<uint8_t> m_rxBuffer;
+  std::size_t m_rxBegin;
+  std::size_t m_rxEnd;
+
+  // A frame too large for the receive buffer that is being read directly into
+  // its packet (invalid type if none) and how much of its payload has arrived:
+  ComPacket m_largeFrame;
+  std::size_t m_largeReceived;
+  bool m_largeMoreFragments;
+
+  // Payload bytes of a rejected (unknown type) frame that are still to be discarded:
+  std::size_t m_skipBytes;
+
+  // Batch subscribers holding packets that have not been delivered yet (only accessed from the receiving thread):
+  std::vector<SubscriberPtr> m_pendingBatches;
+
+  // A fragmented packet being reassembled into a pooled buffer (its first 'size' bytes are valid):
+  struct Reassembly {
+    PooledBuffer buffer;
+    std::size_t size = 0;
+    bool discarding  = false;  ///< Over the size limit: fragments are dropped up to the last one.
+  };
+
+  // Fragmented packets received so far, by packet type (only accessed from the receiving thread):
+  std::unordered_map<IdManager::PacketType, Reassembly> m_fragments;
+  const std::size_t m_maxReassembledBytes;
+
+  std::vector<RxCounters> m_counters;
+  std::atomic<std::uint64_t> m_numReads;
+  std::atomic<std::uint64_t> m_numBytesRead;
+  std::atomic<std::uint64_t> m_numUnknownPackets;
+  std::atomic<std::uint64_t> m_dispatchEpoch;  // Odd while subscribers are being called.
+  std::atomic<std::thread::id> m_dispatchThread;
+  bool m_helloReceived;
+
+  // Received packets are allocated from here so that they are
+  // recycled once all subscribers have released them:
+  std::shared_ptr<PacketBufferPool> m_pool;
 
   // This must be initialised last to ensure all other members are intialised before the thread starts:
   std::thread m_receiverThread;
 
   void receiveHelloMessage(ComPacket& packet, int timeoutInMillisecs);
+  void checkHelloMessage(ComPacket& packet);
   void handleControlMessage(const ComPacket::ConstSharedPacket& sptr);
   ControlMessage getControlMessage(const ComPacket::ConstSharedPacket& sptr);
   void warnAboutSubscribers();
@@ -9,6 +9,8 @@
 
 #include <algorithm>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
 #include <type_traits>
 
 /**
@@ -17,27 +19,79 @@
 
     This object is guaranteed to only ever write to the socket.
 */
-PacketMuxer::PacketMuxer(AbstractWriter& socket, const std::vector<std::string>& packetIds)
+PacketMuxer::PacketMuxer(AbstractWriter& socket, const std::vector<std::string>& packetIds, const MuxerOptions& options)
     : m_packetIds(packetIds),
+      m_senderWaiting(false),
       m_numPosted(0),
       m_numSent(0),
+      m_numWriteStalls(0),
+      m_counters(m_packetIds.size()),
+      m_queuedPackets(0),
+      m_queuedBytes(0),
+      m_maxQueuedBytes(options.maxQueuedBytes),
+      m_numBlocked(0),
+      m_inlineSend(options.inlineSend && options.coalesceDelay.count() == 0),
+      m_inlinePending(false),
+      m_channels(m_packetIds.size()),
+      m_numQueued(0),
+      m_coalesceDelay(options.coalesceDelay),
+      m_coalesceBytes(options.coalesceBytes),
+      m_coalescePackets(options.coalescePackets),
+      m_cork(options.cork),
+      m_queueLatency(options.latencyHistograms ? m_packetIds.size() : 0),
+      m_writeLatency(options.latencyHistograms ? m_packetIds.size() : 0),
+      m_maxFragmentSize(options.maxFragmentSize),
+      m_gatherBegin(0),
+      m_writeBlocked(false),
+      m_lastActivity(std::chrono::steady_clock::now()),
       m_transport(socket),
       m_transportError(false),
-      m_sendThread(std::bind(&PacketMuxer::sendLoop, std::ref(*this))) {
+      m_stalled(false),
+      m_writeStallTimeout(options.writeStallTimeout) {
+  for (auto& channel : m_channels) {
+    channel.options = options.defaults;
+  }
+  for (const auto& entry : options.channels) {
+    m_channels[m_packetIds.toId(entry.first)].options = entry.second;
+  }
+
+  // Control messages (e.g. heart beats) always take precedence and are never limited:
+  ChannelOptions& control = m_channels[IdManager::ControlPacket].options;
+  control                 = ChannelOptions();
+  control.scheduling      = Scheduling::Priority;
+  control.priority        = std::numeric_limits<int>::max();
+
+  for (IdManager::PacketType type = IdManager::ControlPacket; type < m_channels.size(); ++type) {
+    if (m_channels[type].options.scheduling == Scheduling::Priority) {
+      m_priorityOrder.push_back(type);
+    } else if (m_channels[type].options.quantum == 0) {
+      // A zero quantum would never earn the credit to send anything:
+      throw std::invalid_argument("Fair-share packet type '" + m_packetIds.toString(type) + "' has a zero quantum");
+    } else {
+      m_fairShareOrder.push_back(type);
+    }
+  }
+  std::stable_sort(m_priorityOrder.begin(), m_priorityOrder.end(), [this](IdManager::PacketType a, IdManager::PacketType b) {
+    return m_channels[a].options.priority > m_channels[b].options.priority;
+  });
+
   m_transport.setBlocking(false);
+  if (options.sendThread) {
+    m_sendThread = std::thread(&PacketMuxer::sendLoop, this);
+  } else {
+    sendControlMessage(ControlMessage::Hello);
+  }
 }
 
 PacketMuxer::~PacketMuxer() {
-  {
-    std::lock_guard<std::recursive_mutex> guard(m_txLock);
-    m_transportError = true;  /// Causes threads to exit (@todo use better method)
-    m_txReady.notify_all();
-  }
+  signalTransportError();  /// Causes threads to exit (@todo use better method)
 
-  try {
-    m_sendThread.join();
-  } catch (const std::system_error& e) {
-    std::clog << "Error: " << e.what() << std::endl;
+  if (m_sendThread.joinable()) {
+    try {
+      m_sendThread.join();
+    } catch (const std::system_error& e) {
+      std::clog << "Error: " << e.what() << std::endl;
+    }
   }
 }
 
@@ -48,6 +102,95 @@ bool PacketMuxer::ok() const {
   return m_transportError == false;
 }
 
+/**
+    Return true if the muxer failed because the transport stopped accepting
+    data for longer than MuxerOptions::writeStallTimeout (ok() is also false).
+*/
+bool PacketMuxer::stalled() const {
+  return m_stalled;
+}
+
+/**
+    Take a snapshot of the muxer's statistics. This is cheap enough to call
+    at any time from any thread and does not block posting or sending.
+
+    Each counter is read atomically. The packets sent and conflated are
+    read before the number posted, so a snapshot never shows more of them
+    than were posted. The number dropped is not bounded by the number
+    posted: it also counts packets that were rejected rather than queued
+    (DropNewest, the byte budget, or packets too large for their limits).
+*/
+MuxerStats PacketMuxer::getStats() const {
+  MuxerStats stats;
+  stats.types.resize(m_counters.size());
+  for (std::size_t type = 0; type < m_counters.size(); ++type) {
+    const TxCounters& counters = m_counters[type];
+    PacketTypeStats& s         = stats.types[type];
+    s.name                     = m_packetIds.toString(type);
+    s.packets                  = counters.sent;
+    s.bytes                    = counters.sentBytes;
+    s.dropped                  = counters.dropped;
+    s.conflated                = counters.conflated;
+    s.writeStalls              = counters.writeStalls;
+    s.queueDepth               = counters.queuedPackets;
+    s.queueHighWater           = counters.queueHighWater;
+    s.posted                   = counters.posted;
+  }
+  stats.writeStalls = m_numWriteStalls;
+  return stats;
+}
+
+/**
+    @return Summary of the time packets of the named type spent queued before being
+    written. Empty unless MuxerOptions::latencyHistograms was set.
+*/
+LatencySummary PacketMuxer::getQueueLatency(std::string_view name) const {
+  return m_queueLatency.empty() ? LatencySummary() : m_queueLatency[m_packetIds.toId(name)].summary();
+}
+
+/**
+    @return Summary of how long the writes that sent packets of the named type took
+    (e.g. time spent waiting for a congested transport). Empty unless
+    MuxerOptions::latencyHistograms was set.
+*/
+LatencySummary PacketMuxer::getWriteLatency(std::string_view name) const {
+  return m_writeLatency.empty() ? LatencySummary() : m_writeLatency[m_packetIds.toId(name)].summary();
+}
+
+uint64_t PacketMuxer::getNumDropped() const {
+  uint64_t total = 0;
+  for (const auto& counters : m_counters) {
+    total += counters.dropped;
+  }
+  return total;
+}
+
+/**
+    @return Number of packets of the named type that were discarded because of
+    Overflow::DropOldest or Overflow::DropNewest. Packets dropped from the front
+    of a DropOldest queue were counted by getNumPosted() but are never counted
+    by getNumSent().
+*/
+uint64_t PacketMuxer::getNumDropped(std::string_view name) const {
+  return m_counters[m_packetIds.toId(name)].dropped;
+}
+
+uint64_t PacketMuxer::getNumConflated() const {
+  uint64_t total = 0;
+  for (const auto& counters : m_counters) {
+    total += counters.conflated;
+  }
+  return total;
+}
+
+/**
+    @return Number of packets of the named type that were replaced by a newer packet before
+    they were sent. Like dropped packets these were counted by getNumPosted() but not getNumSent().
+*/
+uint64_t PacketMuxer::getNumConflated(std::string_view name) const {
+  return m_counters[m_packetIds.toId(name)].conflated;
+}
+
 /**
     This function loops sending all the queued packets over the
     transport layer. The loop exits if there is a transport error
@@ -61,113 +204,785 @@ void PacketMuxer::sendLoop() {
 
   sendControlMessage(ControlMessage::Hello);
 
-  // Grab the lock for the transmit/send queues:
-  std::unique_lock<std::recursive_mutex> guard(m_txLock);
-
   while (m_transportError == false) {
-    if (m_numPosted == m_numSent) {
-      // Atomically relinquish lock for send queues and wait
-      // until new data is posted (don't care to which queue it
-      // is posted, hence one condition variable for all queues):
-      std::cv_status status = m_txReady.wait_for(guard, std::chrono::seconds(1));
-      if (status == std::cv_status::timeout) {
-        // If there are no packets to send after waiting for 1 second then
-        // send a 'HeartBeat' message - this serves two purposes:
-        // 1. Lets the other side know we are still connected.
-        // 2. Lets this side detect if the other side has hung up or crashed (Sending the packet will fail at the socket level).
-        // These are similar to TCP keep-alive messages, but there is no defined standard about how to use TCP keepalive to
-        // achieve the same behaviour:
-        sendControlMessage(ControlMessage::HeartBeat);
-      }
+    std::unique_lock<std::mutex> sendGuard(m_sendLock);
+
+    // Finish a batch that an inline sender could only partly write:
+    m_inlinePending = false;
+    if (m_inFlight.empty() == false) {
+      finishBatch(writeBatch());
+      continue;
     }
 
-    // Send in priority order:
-    /// @todo if one queue is always full we could get starvation here...how to fix? Counter for each queue
-    /// indicating how many send loops it has been not empty?
-    /// (But in that case the system is overloaded anyway so what would we like to do when overloaded?)
-    for (auto& pair : m_txQueues) {
-      sendAll(pair.second);
+    collectPosted();
+
+    if (m_numQueued == 0) {
+      sendGuard.unlock();
+      waitForPackets();
+      continue;
     }
+
+    if (delayFlush(sendGuard)) {
+      continue;
+    }
+
+    // Packets posted while a batch is being written are collected before the
+    // next batch is scheduled so priority types wait for at most one batch:
+    scheduleBatch();
+    sendBatch();
   }
 
+  // Producers blocked on full queues must not wait forever:
+  signalSpaceAvailable();
+
   std::clog << "PacketMuxer::sendLoop() exited." << std::endl;
 }
 
 /**
-    Send all the packets from the FIFO container. The container will
-    be empty after calling this function, regardless of whether there
-    were any errors from the transport layer.
+    Move everything posted since the last call from the lock-free
+    posting queue into the per-type send queues.
+*/
+void PacketMuxer::collectPosted() {
+  TxEntry entry;
+  while (m_posted.pop(entry)) {
+    queueEntry(std::move(entry));
+  }
+}
+
+/**
+    Add a posted packet to its type's send queue, applying conflation and drop policies.
+*/
+void PacketMuxer::queueEntry(TxEntry&& entry) {
+  const IdManager::PacketType type = entry.packet->getType();
+  TxChannel& channel               = m_channels[type];
+  if (channel.options.conflate && conflate(channel, entry)) {
+    return;
+  }
+
+  channel.queue.emplace_back(std::move(entry));
+  if (m_numQueued == 0) {
+    m_oldestQueued = std::chrono::steady_clock::now();
+  }
+  m_numQueued += 1;
+
+  if (channel.options.overflow == Overflow::DropOldest) {
+    trimChannel(channel, type);
+  }
+}
+
+/**
+    Replace a queued packet that has the same key as the new entry.
+
+    @return true if a packet was replaced, false if the new entry still needs to be queued.
+*/
+bool PacketMuxer::conflate(TxChannel& channel, TxEntry& entry) {
+  // A packet that is part way through being sent as fragments can not be replaced:
+  const auto first = channel.queue.begin() + (channel.offset > 0 ? 1 : 0);
+  auto itr         = std::find_if(first, channel.queue.end(), [&entry](const TxEntry& queued) {
+    return queued.key == entry.key;
+  });
+  if (itr == channel.queue.end()) {
+    return false;
+  }
+
+  const IdManager::PacketType type = entry.packet->getType();
+  release(type, itr->packet->getDataSize());
+  std::swap(itr->packet, entry.packet);
+  std::swap(itr->posted, entry.posted);
+  m_counters[type].conflated += 1;
+  signalSpaceAvailable();
+  return true;
+}
+
+/**
+    Discard the oldest packets of a type until it is within its own limits
+    (the muxer's byte budget is applied when packets are posted).
+*/
+void PacketMuxer::trimChannel(TxChannel& channel, IdManager::PacketType type) {
+  // A packet that is part way through being sent as fragments must be completed:
+  const std::size_t keep = channel.offset > 0 ? 1 : 0;
+  bool dropped           = false;
+  while (channel.queue.size() > keep && overTypeLimit(type)) {
+    const auto oldest = channel.queue.begin() + keep;
+    release(type, oldest->packet->getDataSize());
+    channel.queue.erase(oldest);
+    m_numQueued -= 1;
+    m_counters[type].dropped += 1;
+    dropped = true;
+  }
+
+  if (dropped) {
+    signalSpaceAvailable();
+  }
+}
+
+/**
+    Sleep until a packet is posted or one second passes.
+*/
+void PacketMuxer::waitForPackets() {
+  const std::cv_status status = waitForPosted(std::chrono::seconds(1));
+  if (status == std::cv_status::timeout && m_posted.empty()) {
+    // If there are no packets to send after waiting for 1 second then
+    // send a 'HeartBeat' message - this serves two purposes:
+    // 1. Lets the other side know we are still connected.
+    // 2. Lets this side detect if the other side has hung up or crashed (Sending the packet will fail at the socket level).
+    // These are similar to TCP keep-alive messages, but there is no defined standard about how to use TCP keepalive to
+    // achieve the same behaviour:
+    sendControlMessage(ControlMessage::HeartBeat);
+  }
+}
+
+/**
+    Sleep until a packet is posted or the timeout expires.
+
+    m_senderWaiting is set before the final check of the posting queue and
+    producers check it after pushing (both separated by full fences) so either
+    this thread sees the new packet or the producer sees that it must notify.
+*/
+std::cv_status PacketMuxer::waitForPosted(std::chrono::steady_clock::duration timeout) {
+  std::cv_status status = std::cv_status::no_timeout;
+  std::unique_lock<std::mutex> guard(m_txLock);
+  m_senderWaiting.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_posted.empty() && m_inlinePending == false && m_transportError == false) {
+    status = m_txReady.wait_for(guard, timeout);
+  }
+  m_senderWaiting.store(false, std::memory_order_relaxed);
+  return status;
+}
 
-    @note Assumes you have acquired the appropriate
-    lock to access the specified PacketContainer.
+/**
+    When write coalescing is enabled, wait for more packets instead of sending
+    the queued ones if none of the flush conditions has been met yet.
 
-    @bug Bug on shutdown - the queues are always empty so we never attempt to send any packets
-    and therefore never get to state where m_transportError is true, hence the caller loops forever.
+    @return true if the queued packets were held back (the caller must collect again).
+    The send lock is released while waiting.
 */
-void PacketMuxer::sendAll(ComPacket::PacketContainer& packets) {
-  while (m_transportError == false && packets.empty() == false) {
-    // Here we must send before popping to guarantee the shared_ptr is valid for the lifetime of SendPacket.
-    sendPacket(*(packets.front().get()));
-    packets.pop();
-    m_numSent += 1;
+bool PacketMuxer::delayFlush(std::unique_lock<std::mutex>& sendGuard) {
+  if (m_coalesceDelay.count() == 0) {
+    return false;
+  }
+
+  const auto remaining = m_oldestQueued + m_coalesceDelay - std::chrono::steady_clock::now();
+  const bool flush     = remaining.count() <= 0 ||
+                     (m_coalesceBytes > 0 && m_queuedBytes >= m_coalesceBytes) ||
+                     (m_coalescePackets > 0 && m_numQueued >= m_coalescePackets);
+  if (flush) {
+    return false;
+  }
+
+  sendGuard.unlock();
+  waitForPosted(remaining);
+  return true;
+}
+
+/**
+    Choose the packets for the next batch:
+
+    1. Every queued packet of the strict priority types, highest priority first.
+    2. One deficit round robin round over the fair-share types: each type with packets
+       queued is credited its quantum of bytes and sends packets while its credit lasts.
+       A type's credit is reset when its queue empties so idle types can not save up.
+
+    A single round is bounded by the sum of the quanta so bulk types can only
+    delay priority types by roughly that many bytes.
+
+    When fragmentation is enabled each fragment is scheduled like a packet. A
+    priority type that is part way through a fragmented packet ends the batch
+    after one fragment so that newly posted packets of higher priority types
+    are only delayed by a single fragment.
+*/
+void PacketMuxer::scheduleBatch() {
+  m_inFlight.clear();
+
+  for (const IdManager::PacketType type : m_priorityOrder) {
+    TxChannel& channel = m_channels[type];
+    while (channel.queue.empty() == false) {
+      if (takeFragment(channel) == false) {
+        return;
+      }
+    }
+  }
+
+  for (const IdManager::PacketType type : m_fairShareOrder) {
+    TxChannel& channel = m_channels[type];
+    if (channel.queue.empty()) {
+      continue;
+    }
+
+    channel.deficit += channel.options.quantum;
+    while (channel.queue.empty() == false) {
+      const std::int64_t cost = nextFragmentSize(channel);
+      if (cost > channel.deficit) {
+        break;
+      }
+      channel.deficit -= cost;
+      takeFragment(channel);
+    }
+
+    if (channel.queue.empty()) {
+      channel.deficit = 0;
+    }
+  }
+}
+
+/**
+    @return Payload bytes in the next fragment of the channel's front packet
+    (the whole remaining payload if fragmentation is disabled).
+*/
+std::size_t PacketMuxer::nextFragmentSize(const TxChannel& channel) const {
+  const std::size_t remaining = channel.queue.front().packet->getDataSize() - channel.offset;
+  return m_maxFragmentSize > 0 ? std::min(remaining, m_maxFragmentSize) : remaining;
+}
+
+/**
+    Move the next fragment of the channel's front packet into the batch.
+
+    @return true if that completed the packet (which is removed from the queue).
+*/
+bool PacketMuxer::takeFragment(TxChannel& channel) {
+  TxEntry& front         = channel.queue.front();
+  const std::size_t size = nextFragmentSize(channel);
+  const bool last        = channel.offset + size == front.packet->getDataSize();
+
+  if (last) {
+    m_inFlight.push_back({std::move(front.packet), channel.offset, size, true, front.posted});
+    channel.queue.pop_front();
+    channel.offset = 0;
+    m_numQueued -= 1;
+  } else {
+    m_inFlight.push_back({front.packet, channel.offset, size, false, front.posted});
+    channel.offset += size;
+  }
+  return last;
+}
+
+/**
+    Send all the packets in the current batch. The batch will be empty
+    after calling this function, regardless of whether there were any
+    errors from the transport layer.
+
+    The headers and payloads of all the packets are gathered into a
+    single vectored write so that a burst of small packets costs one
+    system call instead of three per packet.
+
+    @note Must only be called from the send thread.
+*/
+void PacketMuxer::sendBatch() {
+  if (startBatch()) {
+    finishBatch(writeBatch());
+  }
+}
+
+/**
+    Gather the headers and payloads of the scheduled batch ready for writing.
+
+    @return false (and the batch is cleared) if there is nothing to write.
+*/
+bool PacketMuxer::startBatch() {
+  if (m_transportError || m_inFlight.empty()) {
+    m_inFlight.clear();
+    return false;
+  }
+
+  // Headers must be fully allocated before any pointers into them are gathered:
+  constexpr std::size_t wordsPerHeader = 2;
+  m_headers.resize(wordsPerHeader * m_inFlight.size());
+  m_gather.clear();
+  m_gatherBegin = 0;
+  for (std::size_t i = 0; i < m_inFlight.size(); ++i) {
+    gatherFragment(m_inFlight[i], &m_headers[wordsPerHeader * i]);
+  }
+
+  m_writeStart = std::chrono::steady_clock::now();
+  if (m_cork) {
+    m_transport.setCork(true);
+  }
+  return true;
+}
+
+/**
+    Account for the batch once it has been written (or failed) and clear it.
+*/
+void PacketMuxer::finishBatch(bool ok) {
+  if (m_cork) {
+    m_transport.setCork(false);
+  }
+  // Never clear an error that was signalled concurrently (e.g. by the destructor):
+  if (ok == false) {
+    m_transportError = true;
+  }
+  if (ok && m_queueLatency.empty() == false) {
+    recordLatency(m_writeStart, std::chrono::steady_clock::now());
+  }
+
+  // Packets still have fragments queued until their last one is sent:
+  for (const auto& fragment : m_inFlight) {
+    if (fragment.last) {
+      const IdManager::PacketType type = fragment.packet->getType();
+      if (ok) {
+        m_counters[type].sent += 1;
+        m_counters[type].sentBytes += fragment.packet->getDataSize();
+        m_numSent += 1;
+      }
+      release(type, fragment.packet->getDataSize());
+    }
   }
+  m_inFlight.clear();
+  m_gather.clear();
+  m_gatherBegin  = 0;
+  m_lastActivity = std::chrono::steady_clock::now();
+  signalSpaceAvailable();
 }
 
 /**
-    Used internally to send a packet over the transport layer.
+    Append the header and payload of a packet (or fragment of one) to the gather list.
 
     Header is:
-    type (4-bytes)
-    data-size (4-bytes)
+    type (4-bytes, with MoreFragmentsFlag set if this is not the last fragment)
+    data-size (4-bytes, the size of this fragment's payload)
 
     followed by the data payload.
+
+    @param header Storage for the two header words. It must remain valid until the gathered buffers are written.
 */
-void PacketMuxer::sendPacket(const ComPacket& packet) {
+void PacketMuxer::gatherFragment(const TxFragment& fragment, std::uint32_t* header) {
+  const ComPacket& packet = *fragment.packet;
   assert(packet.getType() != IdManager::InvalidPacket);  // Catch attempts to send invalid packets
 
-  // Write the type as an unsigned 32-bit integer in network byte order:
-  size_t writeCount = sizeof(uint32_t);
-  uint32_t type     = htonl(static_cast<uint32_t>(packet.getType()));
-  bool ok           = writeBytes(reinterpret_cast<const uint8_t*>(&type), writeCount);
+  // Type and size are unsigned 32-bit integers in network byte order. The two
+  // words are contiguous so the header takes a single gather buffer, leaving
+  // more of the transport's per call buffer limit for packets:
+  const uint32_t flags = fragment.last ? 0 : MoreFragmentsFlag;
+  header[0]            = htonl(static_cast<uint32_t>(packet.getType()) | flags);
+  header[1]            = htonl(fragment.size);
+  m_gather.push_back({reinterpret_cast<const char*>(header), 2 * sizeof(uint32_t)});
+
+  if (fragment.size > 0) {
+    m_gather.push_back({reinterpret_cast<const char*>(packet.getDataPtr()) + fragment.offset, fragment.size});
+  }
+}
+
+/**
+    Loop to guarantee all the bytes in the current batch are actually written.
+
+    @return true if all bytes were written, false if there was an error at any point.
+*/
+bool PacketMuxer::writeBatch() {
+  // Waits are sliced so that shutdown and drop policies are still serviced:
+  constexpr int maxWaitMs = 100;
+  auto stallStart         = std::chrono::steady_clock::now();
+  bool blocked            = false;
+
+  while (batchWritten() == false) {
+    const int n = writeSome();
+    if (n < 0 || m_transportError) {
+      return false;
+    }
+
+    if (n == 0) {
+      if (blocked == false) {
+        countWriteStall();
+        blocked = true;
+      }
 
-  // Write the data size:
-  uint32_t size = htonl(packet.getDataSize());
-  writeCount    = sizeof(uint32_t);
-  ok &= writeBytes(reinterpret_cast<const uint8_t*>(&size), writeCount);
+      // Keep applying drop policies while the transport is not accepting data:
+      collectPosted();
 
-  // Write the byte data:
-  writeCount = packet.getDataSize();
-  ok &= writeBytes(reinterpret_cast<const uint8_t*>(packet.getDataPtr()), writeCount);
+      const auto stalledFor = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - stallStart);
+      int waitMs            = maxWaitMs;
+      if (m_writeStallTimeout.count() > 0) {
+        if (stalledFor >= m_writeStallTimeout) {
+          std::clog << "PacketMuxer: transport has not accepted data for " << stalledFor.count() << "ms" << std::endl;
+          m_stalled = true;
+          return false;
+        }
+        waitMs = std::min<int>(maxWaitMs, (m_writeStallTimeout - stalledFor).count());
+      }
+      m_transport.readyForWriting(waitMs);
+      continue;
+    }
+    stallStart = std::chrono::steady_clock::now();
+    blocked    = false;
+  }
 
-  m_transportError = !ok;
+  return true;
 }
 
 /**
-    Loop to guarantee the number of bytes requested are actually written.
+    Write as much of the current batch as the transport accepts without waiting.
 
-    On error (return of false) size will contain the number of bytes that were remaining to be written.
+    The gathered buffers are modified in place to track partial writes.
 
-    @return true if all bytes were written, false if there was an error at any point.
+    @return Number of bytes written (zero if the transport is full) or -1 on error.
 */
-bool PacketMuxer::writeBytes(const uint8_t* buffer, size_t& size) {
-  while (size > 0) {
-    int n = m_transport.write(reinterpret_cast<const VectorStream::CharType*>(buffer), size);
+int PacketMuxer::writeSome() {
+  const int n = m_transport.writev(m_gather.data() + m_gatherBegin, m_gather.size() - m_gatherBegin);
+  if (n <= 0) {
+    return n;
+  }
+
+  // Skip over the buffers that were completely written then
+  // adjust the start of the one that was partially written:
+  std::size_t written = n;
+  while (m_gatherBegin < m_gather.size() && written >= m_gather[m_gatherBegin].size) {
+    written -= m_gather[m_gatherBegin].size;
+    m_gatherBegin += 1;
+  }
+  if (m_gatherBegin < m_gather.size()) {
+    m_gather[m_gatherBegin].data += written;
+    m_gather[m_gatherBegin].size -= written;
+  }
+  return n;
+}
+
+/**
+    Send whatever can be sent without waiting. This is the send loop of a muxer
+    without a send thread (see flush()). The caller must hold the send lock.
+
+    @return true if data is waiting for the transport to become writable.
+*/
+bool PacketMuxer::sendAvailable() {
+  while (m_transportError == false) {
+    if (m_inFlight.empty()) {
+      collectPosted();
+      if (m_numQueued == 0) {
+        // See waitForPackets():
+        if (std::chrono::steady_clock::now() - m_lastActivity >= std::chrono::seconds(1)) {
+          m_lastActivity = std::chrono::steady_clock::now();
+          sendControlMessage(ControlMessage::HeartBeat);
+          continue;
+        }
+        return false;
+      }
+
+      scheduleBatch();
+      if (startBatch() == false) {
+        continue;
+      }
+    }
+
+    const int n = writeSome();
+    if (n < 0) {
+      finishBatch(false);
+      break;
+    }
+
+    if (batchWritten() == false) {
+      const auto now = std::chrono::steady_clock::now();
+      if (n > 0 || m_writeBlocked == false) {
+        if (n == 0) {
+          countWriteStall();
+        }
+        m_writeBlocked = n == 0;
+        m_stallStart   = now;
+      } else if (m_writeStallTimeout.count() > 0 && now - m_stallStart >= m_writeStallTimeout) {
+        std::clog << "PacketMuxer: transport has not accepted data for " << m_writeStallTimeout.count() << "ms" << std::endl;
+        m_stalled = true;
+        finishBatch(false);
+        break;
+      }
+
+      // Keep applying drop policies while the transport is not accepting data:
+      collectPosted();
+      return true;
+    }
+
+    m_writeBlocked = false;
+    finishBatch(true);
+  }
+
+  signalSpaceAvailable();
+  return false;
+}
+
+/**
+    Send whatever the transport accepts without waiting. For muxers without a send
+    thread (see MuxerOptions::sendThread): posted packets are only written when
+    this is called (or by an inline sender, see MuxerOptions::inlineSend), so an
+    event loop calls it after posting, whenever the transport becomes writable,
+    and at least once a second so heart beats are sent and write stalls detected.
+
+    @return true if data is waiting for the transport to become writable.
+*/
+bool PacketMuxer::flush() {
+  assert(m_sendThread.joinable() == false);
+  std::lock_guard<std::mutex> sendGuard(m_sendLock);
+  return sendAvailable();
+}
+
+/**
+    The fast path for MuxerOptions::inlineSend: if no other packet is queued or
+    being written (and no other thread is sending) schedule the packet and write
+    as much of it as the transport accepts on the posting thread. Anything left
+    over is handed to the send thread (or driver) as if the packet had been
+    written by it.
+
+    @return true if the packet was taken, false if it must be posted as usual. A
+    packet that was taken was not sent if the transport has failed (see ok()).
+*/
+bool PacketMuxer::sendInline(TxEntry& entry) {
+  std::unique_lock<std::mutex> sendGuard(m_sendLock, std::try_to_lock);
+
+  // The queue counters include this packet so any other means something is outstanding:
+  if (sendGuard.owns_lock() == false || m_queuedPackets != 1 || m_inFlight.empty() == false || m_transportError) {
+    return false;
+  }
+
+  queueEntry(std::move(entry));
+  scheduleBatch();
+  if (startBatch()) {
+    const int n = writeSome();
     if (n < 0 || m_transportError) {
-      return false;
+      finishBatch(false);
+    } else if (batchWritten()) {
+      finishBatch(true);
     }
+  }
 
-    size -= n;
-    buffer += n;
+  const bool more = m_inFlight.empty() == false || m_numQueued > 0;
+  if (more) {
+    m_inlinePending = true;
   }
+  sendGuard.unlock();
 
+  if (more) {
+    signalPacketPosted();
+  }
   return true;
 }
 
-void PacketMuxer::signalPacketPosted() {
+/**
+    Fail the muxer: posting fails from now on and any blocked producers are released.
+*/
+void PacketMuxer::signalTransportError() {
+  {
+    std::lock_guard<std::mutex> guard(m_txLock);
+    m_transportError = true;
+    m_txReady.notify_all();
+  }
+  signalSpaceAvailable();
+}
+
+/**
+    Record the latencies of the packets completed by the batch that was just written:
+
+    - Queueing delay: from being posted until the start of the write that
+      sent the packet's last bytes (for fragmented packets this includes
+      waiting between fragments).
+    - Write duration: how long that write took.
+*/
+void PacketMuxer::recordLatency(std::chrono::steady_clock::time_point writeStart, std::chrono::steady_clock::time_point writeEnd) {
+  for (const auto& fragment : m_inFlight) {
+    if (fragment.last) {
+      const IdManager::PacketType type = fragment.packet->getType();
+      m_queueLatency[type].record(writeStart - fragment.posted);
+      m_writeLatency[type].record(writeEnd - writeStart);
+    }
+  }
+}
+
+/**
+    Count a stall against the muxer and against each type in the batch being written.
+*/
+void PacketMuxer::countWriteStall() {
+  m_numWriteStalls += 1;
+
+  std::vector<IdManager::PacketType> types;
+  for (const auto& fragment : m_inFlight) {
+    types.push_back(fragment.packet->getType());
+  }
+  std::sort(types.begin(), types.end());
+  types.erase(std::unique(types.begin(), types.end()), types.end());
+  for (const IdManager::PacketType type : types) {
+    m_counters[type].writeStalls += 1;
+  }
+}
+
+/**
+    Lock-free post of a packet to the send thread (unless the packet's type
+    uses Overflow::Block and its queue is full).
+
+    Safe to call from any thread (including the send thread itself).
+*/
+bool PacketMuxer::postPacket(TxEntry&& entry, bool allowInline) {
+  // Time spent blocked on a full queue counts as queueing delay:
+  if (m_queueLatency.empty() == false) {
+    entry.posted = std::chrono::steady_clock::now();
+  }
+
+  if (admitPacket(entry.packet->getType(), entry.packet->getDataSize()) == false) {
+    return false;
+  }
+
+  // Count before pushing so the send thread can never see more sent than posted:
+  TxCounters& counters    = m_counters[entry.packet->getType()];
+  const std::size_t depth = counters.queuedPackets;
+  std::size_t highWater   = counters.queueHighWater;
+  while (depth > highWater && !counters.queueHighWater.compare_exchange_weak(highWater, depth)) {
+  }
+  counters.posted += 1;
   m_numPosted += 1;
-  m_txReady.notify_one();
+  if (allowInline && m_inlineSend && sendInline(entry)) {
+    return m_transportError == false;
+  }
+
+  m_posted.push(std::move(entry));
+  signalPacketPosted();
+  return true;
+}
+
+/**
+    Account for a new packet in its type's queue, applying the type's overflow policy if it does not fit.
+
+    @return true if the packet should be queued.
+*/
+bool PacketMuxer::admitPacket(IdManager::PacketType type, std::size_t size) {
+  if (m_transportError) {
+    return false;
+  }
+
+  const Overflow overflow = m_channels[type].options.overflow;
+  if ((overflow == Overflow::Block || overflow == Overflow::DropOldest) && neverFits(type, size)) {
+    // Neither waiting nor discarding older packets could ever make room for it:
+    m_counters[type].dropped += 1;
+    return false;
+  }
+
+  switch (overflow) {
+    case Overflow::Block: {
+      if (tryReserve(type, size)) {
+        return true;
+      }
+      std::unique_lock<std::mutex> guard(m_spaceLock);
+      m_numBlocked += 1;
+      m_spaceReady.wait(guard, [&]() { return m_transportError || tryReserve(type, size); });
+      m_numBlocked -= 1;
+      return m_transportError == false;
+    }
+
+    case Overflow::Fail:
+      return tryReserve(type, size);
+
+    case Overflow::DropOldest:
+      // The send thread discards older packets of this type to keep it within its own limits.
+      // The muxer's byte budget is applied here so other types' backlog can not empty its queue:
+      reserve(type, size);
+      if (m_maxQueuedBytes > 0 && m_queuedBytes > m_maxQueuedBytes) {
+        release(type, size);
+        m_counters[type].dropped += 1;
+        return false;
+      }
+      return true;
+
+    case Overflow::DropNewest:
+      if (tryReserve(type, size)) {
+        return true;
+      }
+      m_counters[type].dropped += 1;
+      return false;
+  }
+
+  return false;
+}
+
+/**
+    Optimistically add a packet to the queue counters then back it out again if that took
+    them over a limit. Concurrent posts may therefore occasionally see a queue as full when
+    the limit would not actually have been exceeded, but the limits are never exceeded.
+*/
+bool PacketMuxer::tryReserve(IdManager::PacketType type, std::size_t size) {
+  reserve(type, size);
+  if (overLimit(type)) {
+    release(type, size);
+    return false;
+  }
+
+  return true;
+}
+
+bool PacketMuxer::overLimit(IdManager::PacketType type) const {
+  if (type == IdManager::ControlPacket) {
+    return false;
+  }
+
+  return overTypeLimit(type) || (m_maxQueuedBytes > 0 && m_queuedBytes > m_maxQueuedBytes);
+}
+
+/**
+    @return true if a type is over its own limits (ChannelOptions::maxPackets and maxBytes).
+*/
+bool PacketMuxer::overTypeLimit(IdManager::PacketType type) const {
+  const ChannelOptions& options = m_channels[type].options;
+  const TxCounters& counters    = m_counters[type];
+  if (type == IdManager::ControlPacket) {
+    return false;
+  }
+
+  return (options.maxPackets > 0 && counters.queuedPackets > options.maxPackets) ||
+         (options.maxBytes > 0 && counters.queuedBytes > options.maxBytes);
+}
+
+/**
+    @return true if a packet is larger than its type's or the muxer's byte limit on its own.
+*/
+bool PacketMuxer::neverFits(IdManager::PacketType type, std::size_t size) const {
+  const ChannelOptions& options = m_channels[type].options;
+  if (type == IdManager::ControlPacket) {
+    return false;
+  }
+
+  return (options.maxBytes > 0 && size > options.maxBytes) || (m_maxQueuedBytes > 0 && size > m_maxQueuedBytes);
 }
 
+void PacketMuxer::reserve(IdManager::PacketType type, std::size_t size) {
+  m_counters[type].queuedPackets += 1;
+  m_counters[type].queuedBytes += size;
+  m_queuedPackets += 1;
+  m_queuedBytes += size;
+}
+
+void PacketMuxer::release(IdManager::PacketType type, std::size_t size) {
+  m_queuedPackets -= 1;
+  m_counters[type].queuedPackets -= 1;
+  m_counters[type].queuedBytes -= size;
+  m_queuedBytes -= size;
+}
+
+/**
+    Wake any producers blocked on full queues. The check of m_numBlocked is
+    elided into a single atomic load when nobody is blocked.
+*/
+void PacketMuxer::signalSpaceAvailable() {
+  if (m_numBlocked > 0) {
+    std::lock_guard<std::mutex> guard(m_spaceLock);
+    m_spaceReady.notify_all();
+  }
+}
+
+/**
+    Wake the send thread, but only if it is actually waiting: when it is already
+    awake it will collect the new packet anyway so the notification is elided.
+    Externally driven muxers call their driver's hook instead.
+*/
+void PacketMuxer::signalPacketPosted() {
+  if (m_postedHook) {
+    m_postedHook();
+    return;
+  }
+
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_senderWaiting.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> guard(m_txLock);
+    m_txReady.notify_one();
+  }
+}
+
+/**
+    Control messages are never sent inline because they are also posted while the send lock is held.
+*/
 void PacketMuxer::sendControlMessage(ControlMessage msg) {
-  emplacePacket(IdManager::ControlString, reinterpret_cast<VectorStream::CharType*>(&msg), sizeof(std::underlying_type<ControlMessage>::type));
+  auto packet = std::make_shared<ComPacket>(IdManager::ControlPacket, reinterpret_cast<VectorStream::CharType*>(&msg),
+                                            sizeof(std::underlying_type<ControlMessage>::type));
+  postPacket({std::move(packet), 0, {}}, false);
 }
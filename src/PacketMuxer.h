@@ -4,20 +4,30 @@
 #ifndef _PACKET_MUXER_H_
 #define _PACKET_MUXER_H_
 
+#include <assert.h>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <iostream>
 #include <memory>
 #include <queue>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
+#include "Channel.h"
 #include "ComPacket.h"
 #include "ControlMessage.h"
 #include "IdManager.h"
+#include "LatencyHistogram.h"
+#include "MpscQueue.h"
+#include "MuxerOptions.h"
+#include "PacketStats.h"
 #include "PacketSubscription.h"
 #include "VectorStream.h"
 #include "network/AbstractSocket.h"
 
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <mutex>
@@ -36,52 +46,229 @@
 
     The muxer receives packets posted to it from any number of threads
     as messages and then sends the packets over the transport layer.
+    Posting is lock-free: packets are pushed onto a multi-producer queue
+    which the send thread drains in batches, so posting threads never
+    wait for socket IO.
+
+    When the transport is saturated the send thread chooses what to send
+    next according to each packet type's ChannelOptions: strict priority
+    types are always sent first and the remaining bandwidth is shared
+    between fair-share types using deficit round robin.
+
+    The transport is non-blocking: while it is full the send thread sleeps
+    until it becomes writable (AbstractWriter::readyForWriting()), and a
+    peer that accepts nothing for MuxerOptions::writeStallTimeout is
+    treated as a failed transport.
+
+    Each type's queue can be bounded by packet count and payload bytes,
+    and the muxer as a whole by a byte budget. What happens to new packets
+    when a limit is reached is selected per type (see Overflow). Types
+    configured to conflate only ever send the latest value posted.
+
+    Optionally large packets are split into fragments which are scheduled
+    individually (see MuxerOptions::maxFragmentSize), and small packets are
+    held back for a bounded time so they can be written together (see
+    MuxerOptions::coalesceDelay).
+
+    Normally the muxer owns a send thread. Alternatively (MuxerOptions::sendThread)
+    it can be driven externally: either by calling flush() from an event loop or by
+    a Reactor, so that one thread can service many muxers. With MuxerOptions::inlineSend
+    a posting thread that finds nothing queued writes its packet itself, avoiding the
+    wake up of the sending thread.
 
     The data itself is currently sent as byte stream over TCP.
 */
 class PacketMuxer {
+  friend class Reactor;
+
  public:
   typedef std::shared_ptr<PacketSubscriber> Subscription;
 
-  PacketMuxer(AbstractWriter& socket, const std::vector<std::string>& packetIds);
+  PacketMuxer(AbstractWriter& socket, const std::vector<std::string>& packetIds, const MuxerOptions& options = MuxerOptions());
   virtual ~PacketMuxer();
 
   bool ok() const;
+  bool stalled() const;
+  bool flush();
+
+  template <typename... Args>
+  bool emplacePacket(std::string_view name, Args&&... args);
 
   template <typename... Args>
-  void emplacePacket(const std::string& name, Args&&... args);
+  bool emplaceKeyedPacket(std::string_view name, std::uint64_t key, Args&&... args);
+
+  template <typename T, typename... Args>
+  bool emplacePacket(Channel<T> channel, Args&&... args);
+
+  template <typename T, typename... Args>
+  bool emplaceKeyedPacket(Channel<T> channel, std::uint64_t key, Args&&... args);
 
-  uint32_t getNumPosted() const { return m_numPosted; };
-  uint32_t getNumSent() const { return m_numSent; };
+  const IdManager& getIdManager() const { return m_packetIds; }
+
+  uint64_t getNumPosted() const { return m_numPosted; };
+  uint64_t getNumSent() const { return m_numSent; };
+  uint64_t getNumDropped() const;
+  uint64_t getNumDropped(std::string_view name) const;
+  uint64_t getNumConflated() const;
+  uint64_t getNumConflated(std::string_view name) const;
+  MuxerStats getStats() const;
+  LatencySummary getQueueLatency(std::string_view name) const;
+  LatencySummary getWriteLatency(std::string_view name) const;
 
  protected:
-  typedef std::pair<IdManager::PacketType, ComPacket::PacketContainer> MapEntry;
   typedef std::pair<IdManager::PacketType, std::vector<Subscription> > SubscriptionEntry;
 
+  /// A posted packet and its conflation key:
+  struct TxEntry {
+    ComPacket::SharedPacket packet;
+    std::uint64_t key = 0;
+    std::chrono::steady_clock::time_point posted;  ///< Only set if latency histograms are enabled.
+  };
+
+  /// Send queue and scheduling state for one packet type:
+  struct TxChannel {
+    std::deque<TxEntry> queue;
+    ChannelOptions options;
+    std::int64_t deficit = 0;
+    std::size_t offset   = 0;  ///< Payload bytes of the front packet already sent as fragments.
+  };
+
+  /// A whole packet or one fragment of it scheduled for sending:
+  struct TxFragment {
+    ComPacket::SharedPacket packet;
+    std::size_t offset;
+    std::size_t size;
+    bool last;
+    std::chrono::steady_clock::time_point posted;
+  };
+
   void sendLoop();
-  void sendAll(ComPacket::PacketContainer& packets);
-  void sendPacket(const ComPacket& packet);
+  void collectPosted();
+  void queueEntry(TxEntry&& entry);
+  void waitForPackets();
+  std::cv_status waitForPosted(std::chrono::steady_clock::duration timeout);
+  bool delayFlush(std::unique_lock<std::mutex>& sendGuard);
+  void scheduleBatch();
+  std::size_t nextFragmentSize(const TxChannel& channel) const;
+  bool takeFragment(TxChannel& channel);
+  void trimChannel(TxChannel& channel, IdManager::PacketType type);
+  bool conflate(TxChannel& channel, TxEntry& entry);
+  void sendBatch();
+  bool startBatch();
+  bool writeBatch();
+  int writeSome();
+  bool batchWritten() const { return m_gatherBegin == m_gather.size(); }
+  void finishBatch(bool ok);
+  void gatherFragment(const TxFragment& fragment, std::uint32_t* header);
+
+  bool sendInline(TxEntry& entry);
 
-  bool writeBytes(const uint8_t* buffer, size_t& size);
+  // For externally driven muxers (see MuxerOptions::sendThread):
+  bool sendAvailable();
+  void setPostedHook(std::function<void()> hook) { m_postedHook = std::move(hook); }
+  void signalTransportError();
+
+  void countWriteStall();
+  void recordLatency(std::chrono::steady_clock::time_point writeStart, std::chrono::steady_clock::time_point writeEnd);
 
  private:
+  /// Packets and bytes queued for one type, counted from the moment they are posted
+  /// until they have been sent or dropped, and totals for statistics. Accessed from any thread:
+  struct TxCounters {
+    std::atomic<std::size_t> queuedPackets{0};
+    std::atomic<std::size_t> queuedBytes{0};
+    std::atomic<std::size_t> queueHighWater{0};
+    std::atomic<std::uint64_t> posted{0};
+    std::atomic<std::uint64_t> sent{0};
+    std::atomic<std::uint64_t> sentBytes{0};
+    std::atomic<std::uint64_t> dropped{0};
+    std::atomic<std::uint64_t> conflated{0};
+    std::atomic<std::uint64_t> writeStalls{0};
+  };
+
+  bool postPacket(TxEntry&& entry, bool allowInline = true);
+  bool admitPacket(IdManager::PacketType type, std::size_t size);
+  void reserve(IdManager::PacketType type, std::size_t size);
+  bool tryReserve(IdManager::PacketType type, std::size_t size);
+  bool overLimit(IdManager::PacketType type) const;
+  bool overTypeLimit(IdManager::PacketType type) const;
+  bool neverFits(IdManager::PacketType type, std::size_t size) const;
+  void release(IdManager::PacketType type, std::size_t size);
   void signalPacketPosted();
+  void signalSpaceAvailable();
 
   IdManager m_packetIds;
 
-  // Need a recursive mutex so that we can emplace control packets
-  // to the queue internally while we already hold the tx lock:
-  std::recursive_mutex m_txLock;
-  std::condition_variable_any m_txReady;
-  uint32_t m_numPosted;
-  uint32_t m_numSent;
+  // Packets are posted here from any thread and collected by the send thread:
+  MpscQueue<TxEntry> m_posted;
+
+  // The lock only protects waiting on m_txReady. Producers only take it to
+  // wake the send thread when m_senderWaiting indicates it is asleep:
+  std::mutex m_txLock;
+  std::condition_variable m_txReady;
+  std::atomic<bool> m_senderWaiting;
+  std::atomic<uint64_t> m_numPosted;
+  std::atomic<uint64_t> m_numSent;
+  std::atomic<uint64_t> m_numWriteStalls;
+
+  // Queue accounting for limits. Producers blocked by a full
+  // queue wait on m_spaceReady (see Overflow::Block):
+  std::vector<TxCounters> m_counters;
+  std::atomic<std::size_t> m_queuedPackets;
+  std::atomic<std::size_t> m_queuedBytes;
+  const std::size_t m_maxQueuedBytes;
+  std::mutex m_spaceLock;
+  std::condition_variable m_spaceReady;
+  std::atomic<int> m_numBlocked;
 
-  std::unordered_map<MapEntry::first_type, MapEntry::second_type> m_txQueues;
+  // Held by whichever thread is sending: the send thread (except while it waits),
+  // an inline sender (see MuxerOptions::inlineSend) or the caller of flush().
+  // m_inlinePending tells the send thread an inline sender left data to write:
+  std::mutex m_sendLock;
+  const bool m_inlineSend;
+  std::atomic<bool> m_inlinePending;
+
+  // Per-type send queues indexed by packet type, and the order in which the
+  // scheduler visits them (only accessed while holding m_sendLock):
+  std::vector<TxChannel> m_channels;
+  std::vector<IdManager::PacketType> m_priorityOrder;
+  std::vector<IdManager::PacketType> m_fairShareOrder;
+  std::size_t m_numQueued;
+
+  // Write coalescing (see MuxerOptions::coalesceDelay). m_oldestQueued is
+  // when a packet was queued while there were none (send thread only):
+  const std::chrono::steady_clock::duration m_coalesceDelay;
+  const std::size_t m_coalesceBytes;
+  const std::size_t m_coalescePackets;
+  const bool m_cork;
+  std::chrono::steady_clock::time_point m_oldestQueued;
+
+  // Per type latency histograms indexed by packet type (empty unless MuxerOptions::latencyHistograms is set):
+  std::vector<LatencyHistogram> m_queueLatency;
+  std::vector<LatencyHistogram> m_writeLatency;
+
+  // Packets in the batch currently being sent, and scratch space for gather writes. Buffers before
+  // m_gatherBegin have been written (only accessed from the send thread):
+  const std::size_t m_maxFragmentSize;
+  std::vector<TxFragment> m_inFlight;
+  std::vector<std::uint32_t> m_headers;
+  std::vector<WriteBuffer> m_gather;
+  std::size_t m_gatherBegin;
+  std::chrono::steady_clock::time_point m_writeStart;
+
+  // State of an externally driven muxer between calls to sendAvailable(). The hook
+  // is called after each packet is posted so the driver can schedule sending:
+  std::function<void()> m_postedHook;
+  bool m_writeBlocked;
+  std::chrono::steady_clock::time_point m_stallStart;
+  std::chrono::steady_clock::time_point m_lastActivity;
 
   AbstractWriter& m_transport;
-  bool m_transportError;
+  std::atomic<bool> m_transportError;
+  std::atomic<bool> m_stalled;
+  const std::chrono::milliseconds m_writeStallTimeout;
 
-  // Async function should be initialised last - it requires everything else to
+  // Send thread is started at the end of the constructor - it requires everything else to
   // be setup before it can run:
   std::thread m_sendThread;
 
@@ -89,14 +276,44 @@ class PacketMuxer {
 };
 
 /**
+    Construct a packet of the named type from args (see ComPacket's constructors) and queue it for sending.
+
+    @return true if the packet was queued, false if it was rejected or dropped
+    because its queue was full (see ChannelOptions::overflow) or the transport has failed.
+
     @note Uses perfect forwarding: g++-4.8 and later only.
 */
 template <typename... Args>
-void PacketMuxer::emplacePacket(const std::string& name, Args&&... args) {
+bool PacketMuxer::emplacePacket(std::string_view name, Args&&... args) {
   const IdManager::PacketType type = m_packetIds.toId(name);
-  std::lock_guard<std::recursive_mutex> guard(m_txLock);
-  m_txQueues[type].emplace(std::make_shared<ComPacket>(type, std::forward<Args>(args)...));
-  signalPacketPosted();
+  return postPacket({std::make_shared<ComPacket>(type, std::forward<Args>(args)...), 0, {}});
+}
+
+/**
+    As emplacePacket() but for types that conflate (see ChannelOptions::conflate): the
+    key identifies the entity (e.g. a sensor or robot) the packet holds the state of, so
+    only packets with the same key replace each other. Packets posted using emplacePacket()
+    all have key zero.
+*/
+template <typename... Args>
+bool PacketMuxer::emplaceKeyedPacket(std::string_view name, std::uint64_t key, Args&&... args) {
+  const IdManager::PacketType type = m_packetIds.toId(name);
+  return postPacket({std::make_shared<ComPacket>(type, std::forward<Args>(args)...), key, {}});
+}
+
+/**
+    As emplacePacket() but for a packet type that was resolved up front (no name lookup).
+*/
+template <typename T, typename... Args>
+bool PacketMuxer::emplacePacket(Channel<T> channel, Args&&... args) {
+  assert(channel.valid() && channel.id() < m_packetIds.size());
+  return postPacket({std::make_shared<ComPacket>(channel.id(), std::forward<Args>(args)...), 0, {}});
+}
+
+template <typename T, typename... Args>
+bool PacketMuxer::emplaceKeyedPacket(Channel<T> channel, std::uint64_t key, Args&&... args) {
+  assert(channel.valid() && channel.id() < m_packetIds.size());
+  return postPacket({std::make_shared<ComPacket>(channel.id(), std::forward<Args>(args)...), key, {}});
 }
 
 #endif /* _PACKET_MUXER_H_ */
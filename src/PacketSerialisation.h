@@ -7,8 +7,17 @@
     Any type that has Cereal compatible serialisation functions
     can be serialised direct to a muxer, and directly from a
     shared ComPacket.
+
+    Typed channels (see Channel) tie a packet type to the C++ type it
+    carries so values can be posted and received without naming the
+    packet type or deserialising by hand.
 */
 
+#include <string>
+
+#include "Channel.h"
+#include "PacketDemuxer.h"
+#include "PacketMuxer.h"
 #include "Serialisation.h"
 
 template <typename... Args>
@@ -20,8 +29,30 @@ void serialise(PacketMuxer& muxer, const std::string& id, const Args&... types)
 
 template <typename... Args>
 void deserialise(const ComPacket::ConstSharedPacket& packet, Args&... types) {
-  VectorInputStream stream(packet->getData());
+  VectorInputStream stream(packet->getDataPtr(), packet->getDataSize());
   deserialise(stream, std::forward<Args&>(types)...);
 }
 
+template <typename T>
+bool serialise(PacketMuxer& muxer, Channel<T> channel, const T& value) {
+  VectorOutputStream stream;
+  serialise(stream, value);
+  return muxer.emplacePacket(channel, std::move(stream.get()));
+}
+
+/**
+    Subscribe to a typed channel: each packet received is deserialised
+    into a T (which must be default constructible) before the callback
+    is called with it (as a const T&).
+*/
+template <typename T, typename CallBack>
+PacketSubscription subscribe(PacketDemuxer& demuxer, Channel<T> channel, CallBack callback,
+                             const SubscriberOptions& options = SubscriberOptions()) {
+  return demuxer.subscribe(channel, [callback](const ComPacket::ConstSharedPacket& packet) {
+    T value;
+    deserialise(packet, value);
+    callback(value);
+  }, options);
+}
+
 #endif  // PACKETSERIALISATION_H
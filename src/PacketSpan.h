@@ -0,0 +1,36 @@
+#ifndef PACKETSPAN_H
+#define PACKETSPAN_H
+
+#include <cstddef>
+
+#include "ComPacket.h"
+
+/**
+    A view of a contiguous sequence of received packets, as passed to batch
+    subscribers (see PacketDemuxer::subscribeBatch()). The packets are only
+    viewed for the duration of the callback: copy the shared pointers to
+    keep any of them.
+*/
+class PacketSpan {
+ public:
+  typedef const ComPacket::ConstSharedPacket* const_iterator;
+
+  PacketSpan(const ComPacket::ConstSharedPacket* packets, std::size_t size)
+      : m_packets(packets), m_size(size) {}
+
+  std::size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+  const ComPacket::ConstSharedPacket& operator[](std::size_t i) const { return m_packets[i]; }
+  const ComPacket::ConstSharedPacket& front() const { return m_packets[0]; }
+  const ComPacket::ConstSharedPacket& back() const { return m_packets[m_size - 1]; }
+
+  const_iterator begin() const { return m_packets; }
+  const_iterator end() const { return m_packets + m_size; }
+
+ private:
+  const ComPacket::ConstSharedPacket* m_packets;
+  std::size_t m_size;
+};
+
+#endif  // PACKETSPAN_H
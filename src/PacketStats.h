@@ -0,0 +1,55 @@
+#ifndef PACKETSTATS_H
+#define PACKETSTATS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+    Counters for one packet type. Totals are counted from construction of
+    the muxer or demuxer, queueDepth is the value when the snapshot was taken.
+*/
+struct PacketTypeStats {
+  std::string name;
+  std::uint64_t packets        = 0;  ///< Muxer: packets sent. Demuxer: packets received.
+  std::uint64_t bytes          = 0;  ///< Payload bytes of those packets.
+  std::uint64_t posted         = 0;  ///< Muxer only: packets accepted by emplacePacket().
+  std::uint64_t dropped        = 0;  ///< Muxer only: packets discarded from the queue or rejected by emplacePacket() (not counted as posted).
+  std::uint64_t conflated      = 0;  ///< Muxer only: packets replaced by a newer packet before being sent.
+  std::uint64_t queueDepth     = 0;  ///< Muxer only: packets posted but not yet sent or dropped.
+  std::uint64_t queueHighWater = 0;  ///< Muxer only: largest queueDepth seen.
+  std::uint64_t writeStalls    = 0;  ///< Muxer only: times the transport stopped accepting data part way through writing this type.
+};
+
+/**
+    Snapshot of a PacketMuxer's counters (see PacketMuxer::getStats()).
+    The vector is indexed by packet type ID.
+*/
+struct MuxerStats {
+  std::vector<PacketTypeStats> types;
+  std::uint64_t writeStalls = 0;  ///< Times the transport stopped accepting data.
+};
+
+/**
+    Snapshot of a PacketDemuxer's counters (see PacketDemuxer::getStats()).
+    The vector is indexed by packet type ID.
+*/
+struct DemuxerStats {
+  std::vector<PacketTypeStats> types;
+  std::uint64_t reads          = 0;  ///< Reads from the transport that returned data.
+  std::uint64_t bytesRead      = 0;  ///< Total bytes read from the transport, including headers.
+  std::uint64_t unknownPackets = 0;  ///< Packets discarded because their type ID is not in this demuxer's packet list.
+};
+
+/**
+    Snapshot of one subscription's counters (see PacketSubscription::getStats()).
+    Only subscriptions with a queue (SubscriberOptions::queueLength) queue or drop packets.
+*/
+struct SubscriberStats {
+  std::uint64_t delivered      = 0;  ///< Packets passed to the callback.
+  std::uint64_t dropped        = 0;  ///< Packets discarded by the overflow policy.
+  std::uint64_t queueDepth     = 0;  ///< Packets waiting for the callback: how far the subscriber lags behind receiving.
+  std::uint64_t queueHighWater = 0;  ///< Largest queueDepth seen.
+};
+
+#endif  // PACKETSTATS_H
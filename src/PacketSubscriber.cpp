@@ -1,17 +1,41 @@
 #include "PacketSubscriber.h"
 #include "PacketDemuxer.h"
 
+#include <algorithm>
+
+#include <assert.h>
+
 /**
     This is the only constructor and is protected: the intent being
     that only a PacketDemuxer object can construct a PacketSubscription.
 */
-PacketSubscriber::PacketSubscriber(const IdManager::PacketType type, PacketDemuxer& comms, CallBack& callback)
+PacketSubscriber::PacketSubscriber(const IdManager::PacketType type, PacketDemuxer& comms, CallBack& callback, const SubscriberOptions& options)
+    : m_type(type),
+      m_comms(comms),
+      m_callback(callback),
+      m_options(options),
+      m_stopping(false),
+      m_queueHighWater(0),
+      m_delivered(0),
+      m_dropped(0) {
+}
+
+PacketSubscriber::PacketSubscriber(const IdManager::PacketType type, PacketDemuxer& comms, BatchCallBack& callback, const SubscriberOptions& options)
     : m_type(type),
       m_comms(comms),
-      m_callback(callback) {
+      m_batchCallback(callback),
+      m_options(options),
+      m_stopping(false),
+      m_queueHighWater(0),
+      m_delivered(0),
+      m_dropped(0) {
+  assert(m_options.queueLength == 0);  // Batch callbacks are always called on the receive thread.
+  m_batch.reserve(m_options.maxBatch > 0 ? m_options.maxBatch : 16);
 }
 
 PacketSubscriber::~PacketSubscriber() {
+  requestStop();
+  joinWorker();
 }
 
 /**
@@ -28,3 +52,158 @@ void PacketSubscriber::unsubscribe() {
 bool PacketSubscriber::isSubscribed() const {
   return m_comms.isSubscribed(this);
 }
+
+SubscriberStats PacketSubscriber::getStats() const {
+  SubscriberStats stats;
+  stats.delivered = m_delivered;
+  stats.dropped   = m_dropped;
+  std::lock_guard<std::mutex> guard(m_queueLock);
+  stats.queueDepth     = m_queue.size();
+  stats.queueHighWater = m_queueHighWater;
+  return stats;
+}
+
+/**
+    Start the worker thread for a subscriber with a queue. The worker holds a
+    reference to the subscriber (self) so that the subscriber outlives it even
+    if the last subscription is released from the callback.
+*/
+void PacketSubscriber::startWorker(const std::shared_ptr<PacketSubscriber>& self) {
+  assert(self.get() == this);
+  if (m_options.queueLength > 0) {
+    m_worker = std::thread(&PacketSubscriber::serviceQueue, this, self);
+  }
+}
+
+/**
+    Called by the demuxer's receive thread for each packet of the subscribed type.
+
+    @return true if the packet started a new batch, which the demuxer must
+    deliver with deliverBatch() at the end of the read burst.
+*/
+bool PacketSubscriber::deliver(const ComPacket::ConstSharedPacket& packet) {
+  if (m_batchCallback) {
+    const bool started = m_batch.empty();
+    if (started && m_options.maxBatchDelay.count() > 0) {
+      m_batchStart = std::chrono::steady_clock::now();
+    }
+    m_batch.push_back(packet);
+
+    const bool full    = m_options.maxBatch > 0 && m_batch.size() >= m_options.maxBatch;
+    const bool expired = m_options.maxBatchDelay.count() > 0 &&
+                         std::chrono::steady_clock::now() - m_batchStart >= m_options.maxBatchDelay;
+    if (full || expired) {
+      deliverBatch();
+      return false;
+    }
+    return started;
+  }
+
+  if (m_options.queueLength == 0) {
+    m_callback(packet);
+    m_delivered += 1;
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(m_queueLock);
+  if (m_queue.size() >= m_options.queueLength) {
+    switch (m_options.overflow) {
+      case Overflow::Block:
+        m_notFull.wait(lock, [this]() { return m_queue.size() < m_options.queueLength || m_stopping; });
+        break;
+      case Overflow::DropOldest:
+        m_queue.pop_front();
+        m_dropped += 1;
+        break;
+      case Overflow::Fail:
+      case Overflow::DropNewest:
+        m_dropped += 1;
+        return false;
+    }
+  }
+
+  if (m_stopping) {
+    return false;
+  }
+
+  m_queue.push_back(packet);
+  m_queueHighWater = std::max(m_queueHighWater, m_queue.size());
+  lock.unlock();
+  m_notEmpty.notify_one();
+  return false;
+}
+
+/**
+    Call a batch subscriber's callback with the packets collected so far (if
+    any). Packets collected after the subscriber was stopped are discarded.
+*/
+void PacketSubscriber::deliverBatch() {
+  if (m_batch.empty()) {
+    return;
+  }
+
+  bool stopping = false;
+  {
+    std::lock_guard<std::mutex> guard(m_queueLock);
+    stopping = m_stopping;
+  }
+  if (!stopping) {
+    m_batchCallback(PacketSpan(m_batch.data(), m_batch.size()));
+    m_delivered += m_batch.size();
+  }
+  m_batch.clear();
+}
+
+/**
+    Stop the worker thread. Packets still queued are discarded and
+    a receive thread blocked on a full queue is released.
+*/
+void PacketSubscriber::requestStop() {
+  {
+    std::lock_guard<std::mutex> guard(m_queueLock);
+    m_stopping = true;
+    m_queue.clear();
+  }
+  m_notEmpty.notify_all();
+  m_notFull.notify_all();
+}
+
+/**
+    Wait for the worker thread to exit. If called from the worker itself
+    (i.e. unsubscribing from the callback) it is detached instead and exits
+    once the callback returns.
+*/
+void PacketSubscriber::joinWorker() {
+  if (m_worker.joinable()) {
+    if (std::this_thread::get_id() == m_worker.get_id()) {
+      m_worker.detach();
+    } else {
+      m_worker.join();
+    }
+  }
+}
+
+/**
+    Worker thread: calls the callback for each queued packet. The unnamed
+    parameter only keeps the subscriber alive until the thread exits.
+*/
+void PacketSubscriber::serviceQueue(std::shared_ptr<PacketSubscriber>) {
+  std::unique_lock<std::mutex> lock(m_queueLock);
+  while (true) {
+    m_notEmpty.wait(lock, [this]() { return !m_queue.empty() || m_stopping; });
+    if (m_stopping) {
+      break;
+    }
+
+    ComPacket::ConstSharedPacket packet = std::move(m_queue.front());
+    m_queue.pop_front();
+    lock.unlock();
+    m_notFull.notify_one();
+
+    m_callback(packet);
+    m_delivered += 1;
+    packet.reset();  // Release the packet before waiting for the next one.
+
+    lock.lock();
+  }
+}
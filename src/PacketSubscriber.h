@@ -3,14 +3,30 @@
 
 #include "ComPacket.h"
 #include "IdManager.h"
+#include "PacketSpan.h"
+#include "PacketStats.h"
+#include "SubscriberOptions.h"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 class PacketDemuxer;
 
 /**
     A packet subscription is a component which can subscribe to
     a particular packet type to be received from a PacketDemuxer.
+
+    If the subscriber has a queue (see SubscriberOptions) the callback is
+    called on the subscriber's own worker thread, otherwise it is called
+    on the demuxer's receive thread. Batch subscribers collect packets and
+    are called with all of them at once on the receive thread.
 */
 class PacketSubscriber {
   friend class PacketDemuxer;       /// friended so it can access m_callback directly @todo Expose callback through getter instead?
@@ -18,6 +34,7 @@ class PacketSubscriber {
 
  public:
   typedef std::function<void(const ComPacket::ConstSharedPacket&)> CallBack;
+  typedef std::function<void(const PacketSpan&)> BatchCallBack;
 
   virtual ~PacketSubscriber();
   PacketSubscriber(PacketSubscriber&)  = delete;
@@ -27,15 +44,44 @@ class PacketSubscriber {
 
   const PacketDemuxer& getDemuxer() const { return m_comms; };
 
+  SubscriberStats getStats() const;
+
  protected:
-  PacketSubscriber(const IdManager::PacketType, PacketDemuxer&, CallBack&);
+  PacketSubscriber(const IdManager::PacketType, PacketDemuxer&, CallBack&, const SubscriberOptions& = SubscriberOptions());
+  PacketSubscriber(const IdManager::PacketType, PacketDemuxer&, BatchCallBack&, const SubscriberOptions&);
   void unsubscribe();
   bool isSubscribed() const;
 
+  void startWorker(const std::shared_ptr<PacketSubscriber>& self);
+  bool deliver(const ComPacket::ConstSharedPacket& packet);
+  void deliverBatch();
+  void requestStop();
+  void joinWorker();
+
  private:
   const IdManager::PacketType m_type;
   PacketDemuxer& m_comms;
   CallBack m_callback;
+  BatchCallBack m_batchCallback;
+  const SubscriberOptions m_options;
+
+  // Only used by batch subscribers (and only from the receive thread):
+  std::vector<ComPacket::ConstSharedPacket> m_batch;
+  std::chrono::steady_clock::time_point m_batchStart;
+
+  // Only used if the subscriber has a queue:
+  mutable std::mutex m_queueLock;
+  std::condition_variable m_notEmpty;
+  std::condition_variable m_notFull;
+  std::deque<ComPacket::ConstSharedPacket> m_queue;
+  bool m_stopping;
+  std::size_t m_queueHighWater;
+  std::thread m_worker;
+
+  std::atomic<std::uint64_t> m_delivered;
+  std::atomic<std::uint64_t> m_dropped;
+
+  void serviceQueue(std::shared_ptr<PacketSubscriber> self);
 };
 
 #endif  // PACKETSUBSCRIBER_H
@@ -37,3 +37,11 @@ bool PacketSubscription::isSubscribed() const {
 const PacketDemuxer& PacketSubscription::getDemuxer() const {
   return m_subscriber->getDemuxer();
 }
+
+/**
+    @return the subscriber's counters, including how many packets are waiting
+    in its queue (see SubscriberOptions).
+*/
+SubscriberStats PacketSubscription::getStats() const {
+  return m_subscriber->getStats();
+}
@@ -6,6 +6,8 @@
 
 #include <memory>
 
+#include "PacketStats.h"
+
 class PacketSubscriber;
 class PacketDemuxer;
 
@@ -30,6 +32,7 @@ class PacketSubscription {
 
   bool isSubscribed() const;
   const PacketDemuxer& getDemuxer() const;
+  SubscriberStats getStats() const;
 
  protected:
  private:
@@ -0,0 +1,140 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "Channel.h"
+#include "ComPacket.h"
+#include "IdManager.h"
+
+namespace protocol_detail {
+
+template <typename P, typename = void>
+struct ValueType {
+  typedef P type;
+};
+
+template <typename P>
+struct ValueType<P, std::void_t<typename P::ValueType>> {
+  typedef typename P::ValueType type;
+};
+
+template <std::size_t N>
+constexpr bool unique(const std::array<std::string_view, N>& names) {
+  for (std::size_t i = 0; i < N; ++i) {
+    for (std::size_t j = i + 1; j < N; ++j) {
+      if (names[i] == names[j]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace protocol_detail
+
+/**
+    A packet type list fixed at compile time. Each packet is described by a
+    type with a static PacketName member. It is either the type that is
+    sent itself or a tag that names the sent type as ValueType:
+
+        struct Pose {
+          static constexpr const char* PacketName = "Pose";
+          ...
+        };
+        struct ImageTag {
+          static constexpr const char* PacketName = "Image";
+          typedef Image ValueType;
+        };
+        typedef Protocol<Pose, ImageTag> RobotProtocol;
+
+        PacketMuxer muxer(socket, RobotProtocol::names());
+        constexpr auto image = RobotProtocol::channel<ImageTag>();  // Channel<Image>
+
+    Ids are assigned in list order exactly as IdManager assigns them from
+    names(), so both ends built from the same definition always agree.
+    Duplicate names are a compile error. dispatch() switches on a received
+    packet's type through a constant jump table.
+*/
+template <typename... Packets>
+class Protocol {
+ public:
+  static_assert(sizeof...(Packets) > 0, "A Protocol needs at least one packet type");
+
+  static constexpr std::size_t size() { return sizeof...(Packets); }
+
+  static constexpr std::array<std::string_view, sizeof...(Packets)> Names = {{std::string_view(Packets::PacketName)...}};
+  static_assert(protocol_detail::unique(Names), "Packet names in a Protocol must be unique");
+
+  /// Id of the first packet in the list (ids below it are reserved by IdManager):
+  static constexpr IdManager::PacketType FirstId = IdManager::ControlPacket + 1;
+
+  template <typename P>
+  static constexpr IdManager::PacketType id() {
+    constexpr std::size_t index = indexOf<P>();
+    static_assert(index < size(), "Packet is not part of this Protocol");
+    return FirstId + index;
+  }
+
+  /// @throws std::out_of_range if the name is not in the list (a compile error in a constant expression).
+  static constexpr IdManager::PacketType id(std::string_view name) {
+    for (std::size_t i = 0; i < size(); ++i) {
+      if (Names[i] == name) {
+        return FirstId + i;
+      }
+    }
+    throw std::out_of_range("Packet name is not part of this Protocol");
+  }
+
+  template <typename P>
+  static constexpr Channel<typename protocol_detail::ValueType<P>::type> channel() {
+    return Channel<typename protocol_detail::ValueType<P>::type>(id<P>());
+  }
+
+  /// Names in id order, for constructing a PacketMuxer or PacketDemuxer (or IdManager).
+  static std::vector<std::string> names() { return std::vector<std::string>(Names.begin(), Names.end()); }
+
+  /**
+      Call handler(channel<P>(), packet) where P is the packet's type in this protocol.
+
+      @return false (without calling the handler) if the packet's type is not in the protocol.
+  */
+  template <typename Handler>
+  static bool dispatch(const ComPacket::ConstSharedPacket& packet, Handler&& handler) {
+    typedef std::remove_reference_t<Handler> HandlerType;
+    typedef void (*Entry)(HandlerType&, const ComPacket::ConstSharedPacket&);
+    static constexpr Entry table[] = {&invoke<Packets, HandlerType>...};
+
+    const IdManager::PacketType type = packet->getType();
+    if (type < FirstId || type - FirstId >= size()) {
+      return false;
+    }
+    table[type - FirstId](handler, packet);
+    return true;
+  }
+
+ private:
+  template <typename P>
+  static constexpr std::size_t indexOf() {
+    constexpr bool matches[] = {std::is_same<P, Packets>::value...};
+    for (std::size_t i = 0; i < size(); ++i) {
+      if (matches[i]) {
+        return i;
+      }
+    }
+    return size();
+  }
+
+  template <typename P, typename HandlerType>
+  static void invoke(HandlerType& handler, const ComPacket::ConstSharedPacket& packet) {
+    handler(channel<P>(), packet);
+  }
+};
+
+#endif  // PROTOCOL_H
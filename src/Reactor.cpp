@@ -0,0 +1,421 @@
+#include "Reactor.h"
+
+#ifdef __linux
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <iostream>
+
+namespace {
+
+// Period of the tick that sends heart beats and enforces write stall timeouts:
+constexpr int TickIntervalInMilliseconds = 100;
+
+// Bounds the packets one connection may receive before the others get a turn:
+constexpr std::size_t MaxPacketsPerRead = 64;
+
+constexpr int MaxEventsPerWait = 64;
+
+void setInterest(int epollFd, int op, int fd, bool readable, bool writable) {
+  epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = 0;
+  if (readable) {
+    ev.events |= EPOLLIN | EPOLLRDHUP;
+  }
+  if (writable) {
+    ev.events |= EPOLLOUT;
+  }
+  ev.data.fd = fd;
+  if (epoll_ctl(epollFd, op, fd, &ev) == -1) {
+    std::clog << "Reactor: epoll_ctl() failed: " << strerror(errno) << std::endl;
+  }
+}
+
+}  // namespace
+
+Reactor::Connection::Connection(std::unique_ptr<TcpSocket> socket, const std::vector<std::string>& packetIds,
+                                const MuxerOptions& options, Loop& loop)
+    : m_socket(std::move(socket)),
+      m_muxer(*m_socket, packetIds, options),
+      m_demuxer(*m_socket, packetIds, DemuxerOptions{false}),
+      m_loop(&loop),
+      m_wakePending(false),
+      m_closing(false),
+      m_registered(false),
+      m_removed(false),
+      m_readClosed(false),
+      m_writeInterest(false) {
+  m_muxer.setPostedHook([this]() { wake(); });
+}
+
+/**
+    @return false once the connection has been closed or either direction of its transport has failed.
+*/
+bool Reactor::Connection::ok() const {
+  return m_closing == false && m_muxer.ok() && m_demuxer.ok();
+}
+
+/**
+    @return true if the loop should stop servicing the connection. A peer
+    that only stopped sending (half close) can still be written to.
+*/
+bool Reactor::Connection::failed() const {
+  return m_closing || m_muxer.ok() == false || (m_readClosed == false && m_demuxer.ok() == false);
+}
+
+/**
+    Shut the connection down. Packets that have not been sent yet are discarded. May be called from any thread.
+*/
+void Reactor::Connection::close() {
+  m_closing = true;
+  wake();
+}
+
+/**
+    Queue the connection for its loop thread (once until the loop has serviced it).
+*/
+void Reactor::Connection::wake() {
+  if (m_wakePending.exchange(true) == false) {
+    std::lock_guard<std::mutex> guard(m_loopLock);
+    if (m_loop == nullptr) {
+      return;  // Removed from its loop (which may no longer exist).
+    }
+    m_loop->woken.push(shared_from_this());
+    const std::uint64_t one = 1;
+    if (write(m_loop->wakeFd, &one, sizeof(one)) != sizeof(one)) {
+      std::clog << "Reactor: failed to wake loop: " << strerror(errno) << std::endl;
+    }
+  }
+}
+
+/**
+    Start the loop threads.
+
+    @param numThreads Number of loop threads (at least one is always started).
+*/
+Reactor::Reactor(unsigned numThreads)
+    : m_nextLoop(0) {
+  numThreads = std::max(numThreads, 1u);
+  for (unsigned i = 0; i < numThreads; ++i) {
+    auto loop      = std::make_unique<Loop>();
+    loop->epollFd  = epoll_create1(EPOLL_CLOEXEC);
+    loop->wakeFd   = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    loop->lastTick = std::chrono::steady_clock::now();
+    if (loop->epollFd == -1 || loop->wakeFd == -1) {
+      std::clog << "Reactor: could not create event loop: " << strerror(errno) << std::endl;
+    }
+
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = EPOLLIN;
+    ev.data.fd = loop->wakeFd;
+    epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->wakeFd, &ev);
+    m_loops.push_back(std::move(loop));
+  }
+
+  for (auto& loop : m_loops) {
+    loop->thread = std::thread(&Reactor::run, this, std::ref(*loop));
+  }
+}
+
+/**
+    Stop the loop threads. Connections that are still referenced elsewhere
+    remain valid but their muxers and demuxers have failed, and they are
+    detached from their loops so they can still be closed or posted to.
+*/
+Reactor::~Reactor() {
+  for (auto& loop : m_loops) {
+    loop->quit              = true;
+    const std::uint64_t one = 1;
+    if (write(loop->wakeFd, &one, sizeof(one)) != sizeof(one)) {
+      std::clog << "Reactor: failed to wake loop: " << strerror(errno) << std::endl;
+    }
+  }
+
+  for (auto& loop : m_loops) {
+    try {
+      loop->thread.join();
+    } catch (const std::system_error& e) {
+      std::clog << "Error: " << e.what() << std::endl;
+    }
+
+    ConnectionPtr connection;
+    while (loop->woken.pop(connection)) {
+      remove(*loop, connection);
+    }
+    while (loop->connections.empty() == false) {
+      connection = loop->connections.begin()->second;  // remove() erases the map's copy.
+      remove(*loop, connection);
+    }
+
+    ::close(loop->wakeFd);
+    ::close(loop->epollFd);
+  }
+}
+
+/**
+    Hand a connected socket over to the reactor, which creates a muxer and
+    demuxer for it (neither has a thread of its own). The connection is
+    serviced by the next loop thread in turn.
+
+    @param options Options for the connection's muxer (MuxerOptions::sendThread is ignored).
+*/
+Reactor::ConnectionPtr Reactor::add(std::unique_ptr<TcpSocket> socket, const std::vector<std::string>& packetIds,
+                                    const MuxerOptions& options) {
+  return add(m_nextLoop++ % m_loops.size(), std::move(socket), packetIds, options);
+}
+
+/**
+    As add() but the connection is serviced by the given loop thread.
+*/
+Reactor::ConnectionPtr Reactor::add(std::size_t loopIndex, std::unique_ptr<TcpSocket> socket,
+                                    const std::vector<std::string>& packetIds, const MuxerOptions& options) {
+  MuxerOptions muxerOptions = options;
+  muxerOptions.sendThread   = false;
+
+  Loop& loop      = *m_loops[loopIndex];
+  auto connection = std::make_shared<Connection>(std::move(socket), packetIds, muxerOptions, loop);
+  loop.numConnections += 1;
+  connection->wake();  // The loop registers it (and sends the 'Hello' message).
+  return connection;
+}
+
+/**
+    Call onReadable on the given loop thread whenever fd is readable (level triggered).
+
+    @return false if the descriptor could not be added to the loop.
+*/
+bool Reactor::addListener(std::size_t loopIndex, int fd, std::function<void()> onReadable) {
+  Loop& loop = *m_loops[loopIndex];
+  {
+    std::lock_guard<std::mutex> guard(loop.listenerLock);
+    loop.listeners[fd] = std::move(onReadable);
+  }
+
+  epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events  = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl(loop.epollFd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    std::clog << "Reactor: epoll_ctl() failed: " << strerror(errno) << std::endl;
+    removeListener(loopIndex, fd);
+    return false;
+  }
+  return true;
+}
+
+/**
+    Stop calling a listener's handler. Once this returns the handler is not running and will not be called again.
+*/
+void Reactor::removeListener(std::size_t loopIndex, int fd) {
+  Loop& loop = *m_loops[loopIndex];
+  epoll_ctl(loop.epollFd, EPOLL_CTL_DEL, fd, nullptr);
+  std::lock_guard<std::mutex> guard(loop.listenerLock);
+  loop.listeners.erase(fd);
+}
+
+void Reactor::handleListener(Loop& loop, int fd) {
+  std::lock_guard<std::mutex> guard(loop.listenerLock);
+  auto itr = loop.listeners.find(fd);
+  if (itr != loop.listeners.end()) {
+    itr->second();
+  }
+}
+
+std::size_t Reactor::numConnections() const {
+  std::size_t count = 0;
+  for (const auto& loop : m_loops) {
+    count += loop->numConnections;
+  }
+  return count;
+}
+
+void Reactor::run(Loop& loop) {
+  std::clog << "Reactor::run() entered." << std::endl;
+
+  epoll_event events[MaxEventsPerWait];
+  std::vector<ConnectionPtr> readPending;
+
+  while (loop.quit == false) {
+    // Connections that still have packets to receive are revisited without waiting:
+    const int timeout = readPending.empty() ? TickIntervalInMilliseconds : 0;
+    const int n       = epoll_wait(loop.epollFd, events, MaxEventsPerWait, timeout);
+    if (n == -1 && errno != EINTR) {
+      std::clog << "Reactor: epoll_wait() failed: " << strerror(errno) << std::endl;
+      break;
+    }
+
+    std::vector<ConnectionPtr> pending;
+    pending.swap(readPending);
+
+    for (int i = 0; i < n; ++i) {
+      if (events[i].data.fd == loop.wakeFd) {
+        std::uint64_t count = 0;
+        if (read(loop.wakeFd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+          std::clog << "Reactor: failed to read wake counter: " << strerror(errno) << std::endl;
+        }
+        continue;
+      }
+
+      auto itr = loop.connections.find(events[i].data.fd);
+      if (itr != loop.connections.end()) {
+        ConnectionPtr connection = itr->second;
+        handleEvents(loop, connection, events[i].events);
+        if (connection->m_registered && connection->m_demuxer.frameBuffered()) {
+          readPending.push_back(connection);
+        }
+      } else {
+        handleListener(loop, events[i].data.fd);
+      }
+    }
+
+    for (const auto& connection : pending) {
+      if (connection->m_registered && connection->m_demuxer.frameBuffered()) {
+        connection->m_demuxer.receiveAvailable(MaxPacketsPerRead);
+        if (connection->m_demuxer.frameBuffered()) {
+          readPending.push_back(connection);
+        }
+      }
+    }
+
+    serviceWoken(loop);
+
+    const auto now = std::chrono::steady_clock::now();
+    if (now - loop.lastTick >= std::chrono::milliseconds(TickIntervalInMilliseconds)) {
+      loop.lastTick = now;
+      serviceAll(loop);
+    }
+  }
+
+  std::clog << "Reactor::run() exited." << std::endl;
+}
+
+/**
+    Register newly added connections, send what has been posted and close connections on request.
+*/
+void Reactor::serviceWoken(Loop& loop) {
+  ConnectionPtr connection;
+  while (loop.woken.pop(connection)) {
+    connection->m_wakePending = false;  // Clear first so posts from now on wake the loop again.
+
+    if (connection->m_removed) {
+      continue;
+    }
+
+    if (connection->failed()) {
+      if (connection->m_closing) {
+        connection->m_socket->Shutdown();
+      }
+      remove(loop, connection);
+      continue;
+    }
+
+    if (connection->m_registered == false) {
+      const int fd = connection->m_socket->GetFileDescriptor();
+      setInterest(loop.epollFd, EPOLL_CTL_ADD, fd, true, false);
+      loop.connections.emplace(fd, connection);
+      connection->m_registered = true;
+    }
+
+    send(loop, connection);
+  }
+}
+
+/**
+    Periodically give every muxer the chance to send heart beats and detect write stalls.
+*/
+void Reactor::serviceAll(Loop& loop) {
+  std::vector<ConnectionPtr> connections;
+  connections.reserve(loop.connections.size());
+  for (const auto& entry : loop.connections) {
+    connections.push_back(entry.second);
+  }
+  for (const auto& connection : connections) {
+    send(loop, connection);
+  }
+}
+
+void Reactor::handleEvents(Loop& loop, const ConnectionPtr& connection, std::uint32_t events) {
+  PacketDemuxer& demuxer = connection->m_demuxer;
+  if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+    // Nothing more will arrive, so take everything that did before the hang up:
+    while (demuxer.receiveAvailable(MaxPacketsPerRead) > 0 && demuxer.ok()) {
+    }
+  } else if (events & EPOLLIN) {
+    demuxer.receiveAvailable(MaxPacketsPerRead);
+  }
+
+  if (events & (EPOLLHUP | EPOLLERR)) {
+    remove(loop, connection);
+    return;
+  }
+
+  if ((events & EPOLLRDHUP) && connection->m_readClosed == false) {
+    // The peer has only stopped sending; keep writing to it until it goes away:
+    connection->m_readClosed = true;
+    demuxer.signalTransportError();
+    setInterest(loop.epollFd, EPOLL_CTL_MOD, connection->m_socket->GetFileDescriptor(), false,
+                connection->m_writeInterest);
+  }
+
+  if (events & EPOLLOUT) {
+    send(loop, connection);
+  }
+
+  if (connection->m_removed == false && connection->failed()) {
+    remove(loop, connection);
+  }
+}
+
+/**
+    Send until the muxer has nothing left or the socket is full, and only
+    ask to be told about writability while there is data waiting for it.
+*/
+void Reactor::send(Loop& loop, const ConnectionPtr& connection) {
+  const bool waiting = connection->m_muxer.flush();
+  if (connection->m_muxer.ok() == false) {
+    remove(loop, connection);
+    return;
+  }
+
+  if (waiting != connection->m_writeInterest) {
+    setInterest(loop.epollFd, EPOLL_CTL_MOD, connection->m_socket->GetFileDescriptor(),
+                connection->m_readClosed == false, waiting);
+    connection->m_writeInterest = waiting;
+  }
+}
+
+/**
+    Stop servicing a connection and fail its muxer and demuxer (which releases
+    any blocked producers). The connection is detached from the loop so later
+    wake ups (e.g. close() after the reactor is gone) do not touch it.
+*/
+void Reactor::remove(Loop& loop, const ConnectionPtr& connection) {
+  {
+    std::lock_guard<std::mutex> guard(connection->m_loopLock);
+    connection->m_loop = nullptr;
+  }
+
+  if (connection->m_registered) {
+    const int fd = connection->m_socket->GetFileDescriptor();
+    if (epoll_ctl(loop.epollFd, EPOLL_CTL_DEL, fd, nullptr) == -1) {
+      std::clog << "Reactor: epoll_ctl() failed: " << strerror(errno) << std::endl;
+    }
+    loop.connections.erase(fd);
+    connection->m_registered = false;
+  }
+
+  if (connection->m_removed == false) {
+    connection->m_removed = true;
+    loop.numConnections -= 1;
+  }
+  connection->m_muxer.signalTransportError();
+  connection->m_demuxer.signalTransportError();
+}
+
+#endif  // __linux
@@ -0,0 +1,143 @@
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+#ifdef __linux
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "MpscQueue.h"
+#include "MuxerOptions.h"
+#include "PacketDemuxer.h"
+#include "PacketMuxer.h"
+#include "network/TcpSocket.h"
+
+/**
+    Event loop that drives the muxers and demuxers of many connections from
+    a small, fixed number of threads instead of two threads per connection.
+
+    Each loop thread waits on an epoll set of its connections' sockets:
+    readable sockets are drained by the connection's demuxer (subscriber
+    callbacks are called on the loop thread, so they must not block) and
+    the connection's muxer writes whenever packets have been posted and the
+    socket is writable. Posting threads wake the loop through an eventfd,
+    at most once per connection until the loop has serviced it. Heart beats
+    and write stall timeouts are handled by a periodic tick.
+
+    Connections are assigned to loop threads round robin when they are added
+    and stay on that thread. A connection whose transport fails is dropped
+    from its loop; its muxer and demuxer report !ok() from then on. When the
+    peer only shuts down its sending side, the packets that had arrived are
+    still delivered and the demuxer then fails, but the muxer keeps sending.
+
+    @note Write coalescing (MuxerOptions::coalesceDelay) is not applied to
+    connections driven by a reactor.
+*/
+class Reactor {
+  friend class TcpServer;
+  struct Loop;
+
+ public:
+  /**
+      A socket with the muxer and demuxer that are driven by a reactor. The
+      muxer and demuxer are used as normal (posting, subscribing) from any thread.
+  */
+  class Connection : public std::enable_shared_from_this<Connection> {
+    friend class Reactor;
+
+   public:
+    Connection(std::unique_ptr<TcpSocket> socket, const std::vector<std::string>& packetIds,
+               const MuxerOptions& options, Loop& loop);
+
+    PacketMuxer& muxer() { return m_muxer; }
+    PacketDemuxer& demuxer() { return m_demuxer; }
+
+    bool ok() const;
+    void close();
+
+   private:
+    bool failed() const;
+    void wake();
+
+    // The socket is declared first so that it outlives the muxer and demuxer:
+    std::unique_ptr<TcpSocket> m_socket;
+    PacketMuxer m_muxer;
+    PacketDemuxer m_demuxer;
+
+    std::mutex m_loopLock;  ///< Serialises wake() with the connection being removed from its loop.
+    Loop* m_loop;           ///< Null once removed from the loop.
+
+    std::atomic<bool> m_wakePending;  ///< Set while the connection is queued for its loop.
+    std::atomic<bool> m_closing;
+
+    // Only accessed from the loop thread:
+    bool m_registered;
+    bool m_removed;
+    bool m_readClosed;  ///< The peer has stopped sending (the demuxer has failed, the muxer may still send).
+    bool m_writeInterest;
+  };
+
+  typedef std::shared_ptr<Connection> ConnectionPtr;
+
+  explicit Reactor(unsigned numThreads = 1);
+  ~Reactor();
+
+  Reactor(const Reactor&) = delete;
+  Reactor& operator=(const Reactor&) = delete;
+
+  ConnectionPtr add(std::unique_ptr<TcpSocket> socket, const std::vector<std::string>& packetIds,
+                    const MuxerOptions& options = MuxerOptions());
+
+  std::size_t numThreads() const { return m_loops.size(); }
+  std::size_t numConnections() const;
+
+ private:
+  /// One loop thread and the connections it services:
+  struct Loop {
+    int epollFd = -1;
+    int wakeFd  = -1;
+    std::atomic<bool> quit{false};
+    std::atomic<std::size_t> numConnections{0};
+
+    // Connections that were added, posted to, or closed since the loop last looked:
+    MpscQueue<ConnectionPtr> woken;
+
+    // Registered connections by socket descriptor (loop thread only):
+    std::unordered_map<int, ConnectionPtr> connections;
+
+    // Handlers for other readable descriptors (e.g. listening sockets, see TcpServer).
+    // The lock is held while a handler runs so it can be removed from any thread:
+    std::mutex listenerLock;
+    std::unordered_map<int, std::function<void()>> listeners;
+    std::chrono::steady_clock::time_point lastTick;
+
+    std::thread thread;
+  };
+
+  ConnectionPtr add(std::size_t loopIndex, std::unique_ptr<TcpSocket> socket, const std::vector<std::string>& packetIds,
+                    const MuxerOptions& options);
+  bool addListener(std::size_t loopIndex, int fd, std::function<void()> onReadable);
+  void removeListener(std::size_t loopIndex, int fd);
+  void handleListener(Loop& loop, int fd);
+
+  void run(Loop& loop);
+  void serviceWoken(Loop& loop);
+  void serviceAll(Loop& loop);
+  void handleEvents(Loop& loop, const ConnectionPtr& connection, std::uint32_t events);
+  void send(Loop& loop, const ConnectionPtr& connection);
+  void remove(Loop& loop, const ConnectionPtr& connection);
+
+  std::vector<std::unique_ptr<Loop>> m_loops;
+  std::atomic<std::size_t> m_nextLoop;
+};
+
+#endif  // __linux
+
+#endif  // __REACTOR_H__
@@ -0,0 +1,35 @@
+#ifndef SUBSCRIBEROPTIONS_H
+#define SUBSCRIBEROPTIONS_H
+
+#include <chrono>
+#include <cstddef>
+
+#include "MuxerOptions.h"
+
+/**
+    Options for a PacketDemuxer subscription.
+
+    By default callbacks are called on the demuxer's receive thread, so a
+    slow callback delays reading from the transport (and so every other
+    subscriber and, through TCP flow control, the remote muxer). Setting
+    queueLength gives the subscriber its own bounded queue and a worker
+    thread that calls the callback, decoupling it from receiving.
+*/
+struct SubscriberOptions {
+  /// Packets that may wait for the subscriber's worker thread. Zero
+  /// calls the callback directly on the receive thread (no queue or thread):
+  std::size_t queueLength = 0;
+
+  /// What happens when a packet arrives and the queue is full. Block stalls
+  /// the receive thread until the worker takes a packet, DropOldest discards
+  /// the oldest queued packet, DropNewest (or Fail) discards the new packet:
+  Overflow overflow = Overflow::DropOldest;
+
+  /// Batch subscriptions only (see PacketDemuxer::subscribeBatch()). A batch is
+  /// delivered at the end of each read burst, or sooner once it holds maxBatch
+  /// packets or its first packet has waited maxBatchDelay (zero for no limit):
+  std::size_t maxBatch = 0;
+  std::chrono::microseconds maxBatchDelay{0};
+};
+
+#endif  // SUBSCRIBEROPTIONS_H
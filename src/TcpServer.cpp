@@ -0,0 +1,91 @@
+#include "TcpServer.h"
+
+#ifdef __linux
+
+#include <iostream>
+
+namespace {
+
+constexpr int ListenBacklog = 128;
+
+}  // namespace
+
+/**
+    Open and start listening on one socket per reactor loop thread. If the
+    platform does not support SO_REUSEPORT a single shard is used.
+
+    @param options Options for the muxers of accepted connections.
+*/
+TcpServer::TcpServer(Reactor& reactor, int port, const std::vector<std::string>& packetIds,
+                     ConnectionCallBack onConnection, const MuxerOptions& options)
+    : m_reactor(reactor),
+      m_packetIds(packetIds),
+      m_onConnection(std::move(onConnection)),
+      m_options(options),
+      m_numAccepted(0) {
+  for (std::size_t i = 0; i < reactor.numThreads(); ++i) {
+    auto shard       = std::make_unique<Shard>();
+    shard->socket    = std::make_unique<TcpSocket>();
+    shard->loopIndex = i;
+    shard->listening = false;
+
+    const bool shared = shard->socket->SetReusePort();
+    if (shard->socket->Bind(port) && shard->socket->Listen(ListenBacklog)) {
+      shard->socket->setBlocking(false);
+      shard->listening = true;
+    } else {
+      std::clog << "TcpServer: could not listen on port " << port << std::endl;
+    }
+    m_shards.push_back(std::move(shard));
+
+    if (shared == false) {
+      break;
+    }
+  }
+
+  for (auto& shard : m_shards) {
+    if (shard->listening) {
+      Shard* s         = shard.get();
+      shard->listening = m_reactor.addListener(shard->loopIndex, shard->socket->GetFileDescriptor(),
+                                               [this, s]() { acceptAll(*s); });
+    }
+  }
+}
+
+/**
+    Stop accepting. Connections that were already accepted are unaffected.
+*/
+TcpServer::~TcpServer() {
+  for (auto& shard : m_shards) {
+    if (shard->listening) {
+      m_reactor.removeListener(shard->loopIndex, shard->socket->GetFileDescriptor());
+    }
+  }
+}
+
+/**
+    @return true if every shard is listening.
+*/
+bool TcpServer::ok() const {
+  for (const auto& shard : m_shards) {
+    if (shard->listening == false) {
+      return false;
+    }
+  }
+  return m_shards.empty() == false;
+}
+
+/**
+    Accept every pending connection on the shard's socket (called on its loop thread).
+*/
+void TcpServer::acceptAll(Shard& shard) {
+  while (std::unique_ptr<TcpSocket> socket = shard.socket->Accept()) {
+    m_numAccepted += 1;
+    Reactor::ConnectionPtr connection = m_reactor.add(shard.loopIndex, std::move(socket), m_packetIds, m_options);
+    if (m_onConnection) {
+      m_onConnection(connection);
+    }
+  }
+}
+
+#endif  // __linux
@@ -0,0 +1,66 @@
+#ifndef __TCP_SERVER_H__
+#define __TCP_SERVER_H__
+
+#ifdef __linux
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "MuxerOptions.h"
+#include "Reactor.h"
+#include "network/TcpSocket.h"
+
+/**
+    Accepts TCP connections for a Reactor using one listening socket per
+    loop thread (shard). The sockets share the port using SO_REUSEPORT so
+    the kernel spreads incoming connections between their listen queues.
+    Each shard accepts without blocking on its own loop thread and the
+    connection's muxer and demuxer are serviced by that same thread, so
+    connection setup scales with the number of loop threads and a
+    connection never migrates between threads.
+
+    The callback is called on the shard's loop thread for every accepted
+    connection before any of its packets are received, so it can subscribe
+    to the connection's demuxer without missing packets. It must not block
+    or destroy the server.
+*/
+class TcpServer {
+ public:
+  typedef std::function<void(const Reactor::ConnectionPtr&)> ConnectionCallBack;
+
+  TcpServer(Reactor& reactor, int port, const std::vector<std::string>& packetIds,
+            ConnectionCallBack onConnection, const MuxerOptions& options = MuxerOptions());
+  ~TcpServer();
+
+  TcpServer(const TcpServer&) = delete;
+  TcpServer& operator=(const TcpServer&) = delete;
+
+  bool ok() const;
+  std::size_t numShards() const { return m_shards.size(); }
+  std::uint64_t getNumAccepted() const { return m_numAccepted; }
+
+ private:
+  /// A listening socket and the loop thread that accepts on it:
+  struct Shard {
+    std::unique_ptr<TcpSocket> socket;
+    std::size_t loopIndex;
+    bool listening;
+  };
+
+  void acceptAll(Shard& shard);
+
+  Reactor& m_reactor;
+  const std::vector<std::string> m_packetIds;
+  const ConnectionCallBack m_onConnection;
+  const MuxerOptions m_options;
+  std::vector<std::unique_ptr<Shard>> m_shards;
+  std::atomic<std::uint64_t> m_numAccepted;
+};
+
+#endif  // __linux
+
+#endif  // __TCP_SERVER_H__
@@ -57,8 +57,8 @@ class VectorOutputStream : public std::streambuf {
 
 /**
     An input stream buffer that reads directly
-    from a std::vector that is passed into the
-    constructor.
+    from a std::vector (or raw buffer) that is
+    passed into the constructor.
 */
 class VectorInputStream : public std::streambuf {
  public:
@@ -66,11 +66,18 @@ class VectorInputStream : public std::streambuf {
         @param v Vector to input from - this vector must not
         be modified for the lifetime of the VectorInputStream object.
     */
-  explicit VectorInputStream(const VectorStream::Buffer& v) {
-    const std::streambuf::char_type* begin = v.data();
-    setg(const_cast<char_type*>(begin),
-         const_cast<char_type*>(begin),
-         const_cast<char_type*>(begin + v.size()));
+  explicit VectorInputStream(const VectorStream::Buffer& v)
+      : VectorInputStream(v.data(), v.size()) {}
+
+  /**
+        @param data Buffer to input from - the buffer must not
+        be modified for the lifetime of the VectorInputStream object.
+        @param size Number of bytes in the buffer.
+    */
+  VectorInputStream(const std::streambuf::char_type* data, const size_t size) {
+    setg(const_cast<char_type*>(data),
+         const_cast<char_type*>(data),
+         const_cast<char_type*>(data + size));
   }
 
  private:
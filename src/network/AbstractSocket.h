@@ -3,6 +3,15 @@
 
 #include <cstddef>
 
+/**
+    A single contiguous buffer in a gather (vectored) write.
+*/
+struct WriteBuffer
+{
+    const char* data;
+    std::size_t size;
+};
+
 class AbstractWriter
 {
 public:
@@ -10,6 +19,55 @@ public:
     virtual ~AbstractWriter() {}
     virtual void setBlocking( bool )                       = 0;
     virtual int  write( const char*, std::size_t )         = 0;
+
+    /**
+        Wait (sleep) until a write will not block or the timeout expires.
+
+        The default implementation is for transports that can not be waited
+        on: it returns true immediately so callers simply retry the write.
+
+        @return true if a write is expected to make progress.
+    */
+    virtual bool readyForWriting( int ) const
+    {
+        return true;
+    }
+
+    /**
+        While corked the transport may hold back partially filled segments
+        (e.g. TCP_CORK). Uncorking sends anything held immediately. The default
+        implementation does nothing.
+    */
+    virtual void setCork( bool ) {}
+
+    /**
+        Write a sequence of buffers as though they were one contiguous buffer.
+
+        The default implementation falls back to calling write() once per buffer
+        so transports that can not do vectored IO need not implement it.
+
+        @return Total number of bytes written (which may be less than the total size
+        of all the buffers) or -1 if there was an error before any bytes were written.
+    */
+    virtual int writev( const WriteBuffer* buffers, std::size_t count )
+    {
+        int total = 0;
+        for ( std::size_t i = 0; i < count; ++i )
+        {
+            const int n = write( buffers[i].data, buffers[i].size );
+            if ( n < 0 )
+            {
+                return total > 0 ? total : -1;
+            }
+
+            total += n;
+            if ( static_cast<std::size_t>( n ) < buffers[i].size )
+            {
+                break;
+            }
+        }
+        return total;
+    }
 };
 
 class AbstractReader
@@ -13,6 +13,8 @@
   #include <netinet/tcp.h>
   #include <fcntl.h>
   #include <poll.h>
+  #include <sys/uio.h>
+  #include <limits.h>
 #endif
 
 #include "Ipv4Address.h"
@@ -204,6 +206,72 @@ int Socket::write( const char* message, size_t size )
     return n;
 }
 
+/**
+    Gather write: sends a sequence of buffers with a single system call
+    (sendmsg() or WSASend()).
+
+    At most MaxGatherBuffers buffers (IOV_MAX, capped at 1024, where the platform
+    defines it) are submitted per call so the caller must loop until all bytes are
+    written, exactly as it would for write().
+
+    @note  On error (return of -1) errno will still be set, but EAGAIN and EWOULDBLOCK are
+    never returned as errors - instead they return 0 bytes written).
+
+    @return Number of bytes written or -1 if there was an error.
+**/
+int Socket::writev( const WriteBuffer* buffers, size_t count )
+{
+#ifdef IOV_MAX
+    constexpr size_t MaxGatherBuffers = IOV_MAX < 1024 ? IOV_MAX : 1024;
+#else
+    constexpr size_t MaxGatherBuffers = 64;
+#endif
+    if ( count > MaxGatherBuffers )
+    {
+        count = MaxGatherBuffers;
+    }
+
+#ifdef WIN32
+    WSABUF wsaBuffers[MaxGatherBuffers];
+    for ( size_t i = 0; i < count; ++i )
+    {
+        wsaBuffers[i].buf = const_cast<char*>( buffers[i].data );
+        wsaBuffers[i].len = static_cast<ULONG>( buffers[i].size );
+    }
+
+    DWORD sent = 0;
+    int n = WSASend( m_socket, wsaBuffers, static_cast<DWORD>( count ), &sent, 0, 0, 0 );
+    if ( n == 0 )
+    {
+        n = static_cast<int>( sent );
+    }
+    else if ( WSAGetLastError() == WSAEWOULDBLOCK )
+    {
+        n = 0;
+    }
+#else
+    struct iovec iov[MaxGatherBuffers];
+    for ( size_t i = 0; i < count; ++i )
+    {
+        iov[i].iov_base = const_cast<char*>( buffers[i].data );
+        iov[i].iov_len  = buffers[i].size;
+    }
+
+    struct msghdr msg;
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = count;
+
+    int n = sendmsg( m_socket, &msg, MSG_NOSIGNAL );
+    if ( n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+    {
+        n = 0;
+    }
+#endif
+
+    return n;
+}
+
 /**
     @param block True set socket to blocking mode, false sets socket to non-blocking.
 **/
@@ -250,6 +318,14 @@ bool Socket::GetPeerAddress( Ipv4Address& address )
     return false;
 }
 
+/**
+    @return The underlying OS socket descriptor (e.g. for registering with an event loop).
+*/
+int Socket::GetFileDescriptor() const
+{
+    return m_socket;
+}
+
 /**
     Wait (sleep) until data is available for reading from the socket.
 
@@ -272,6 +348,14 @@ bool Socket::ReadyForWriting( int timeoutInMilliseconds ) const
     return WaitForSingleEvent( POLLOUT, timeoutInMilliseconds );
 }
 
+/**
+    AbstractWriter interface to ReadyForWriting().
+*/
+bool Socket::readyForWriting( int timeoutInMilliseconds ) const
+{
+    return ReadyForWriting( timeoutInMilliseconds );
+}
+
 /**
     Use system call poll() to wait on the socket's file descriptor
     for a single poll event.
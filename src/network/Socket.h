@@ -34,13 +34,16 @@ public:
 
     int read( char* message, size_t maxBytes );
     int write( const char* message, size_t size );
+    int writev( const WriteBuffer* buffers, size_t count );
 
     void setBlocking( bool );
 
     bool GetPeerAddress( Ipv4Address& address );
+    int GetFileDescriptor() const;
 
     bool readyForReading( int timeoutInMilliseconds = -1 ) const;
     bool ReadyForWriting( int timeoutInMilliseconds = -1 ) const;
+    bool readyForWriting( int timeoutInMilliseconds ) const;
 
 protected:
     int m_socket;
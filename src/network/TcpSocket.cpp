@@ -31,6 +31,14 @@ TcpSocket::TcpSocket ()
 #endif
     m_socket = socket( AF_INET, SOCK_STREAM, 0 );
     assert( m_socket != -1 );
+
+    // Must be set before Bind() to allow rebinding a port that has connections in TIME_WAIT:
+    int reuse = 1;
+#ifdef WIN32
+    setsockopt( m_socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(int) );
+#else
+    setsockopt( m_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(int) );
+#endif
 }
 
 /**
@@ -73,19 +81,14 @@ bool TcpSocket::Listen( int queueSize )
 
     @note It is the caller's responsibility to delete the returned object.
 
+    If the socket is non-blocking null is returned immediately when no connection is pending.
+
     @return New client socket connection - or null on error or timeout.
 **/
 std::unique_ptr<TcpSocket> TcpSocket::Accept()
 {
   std::unique_ptr<TcpSocket> connection;
 
-  int reuse = 1;
-#ifdef WIN32
-  setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(int));
-#else
-  setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(int));
-#endif
-
   struct sockaddr_in addr;
   memset((void*)&addr, 0, sizeof(sockaddr_in));
 
@@ -99,6 +102,29 @@ std::unique_ptr<TcpSocket> TcpSocket::Accept()
 }
 
 
+/**
+    Allow several sockets to bind the same port (SO_REUSEPORT) so that the
+    kernel spreads incoming connections between their listen queues. Every
+    socket sharing the port must set this before Bind().
+
+    @return false if the option is not supported.
+**/
+bool TcpSocket::SetReusePort()
+{
+#ifdef SO_REUSEPORT
+    int reuse = 1;
+    int result = setsockopt( m_socket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(int) );
+    if ( result < 0 )
+    {
+        fprintf( stderr, "SetSocketOpt failed: %s\n", strerror(errno) );
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
 /**
     Enable TCP Nagle buffering.
 **/
@@ -135,3 +161,26 @@ void TcpSocket::SetNagleBufferingOff()
     }
 }
 
+/**
+    Hold back partial segments while corked (TCP_CORK on Linux, TCP_NOPUSH on
+    BSD derived systems) and send them as soon as the socket is uncorked.
+    Does nothing on platforms without either option.
+**/
+void TcpSocket::setCork( bool on )
+{
+#if defined(TCP_CORK) || defined(TCP_NOPUSH)
+  #ifdef TCP_CORK
+    const int option = TCP_CORK;
+  #else
+    const int option = TCP_NOPUSH;
+  #endif
+    int flag = on ? 1 : 0;
+    int result = setsockopt( m_socket, IPPROTO_TCP, option, (char *) &flag, sizeof(int) );
+    if ( result < 0 )
+    {
+        fprintf( stderr, "SetSocketOpt failed: %s\n", strerror(errno) );
+    }
+#else
+    (void)on;
+#endif
+}
@@ -18,9 +18,13 @@ public:
     bool Listen( int );
     std::unique_ptr<TcpSocket> Accept();
 
+    bool SetReusePort();
+
     void SetNagleBufferingOn();
     void SetNagleBufferingOff();
 
+    void setCork( bool on );
+
 private:
     explicit TcpSocket( int fd );
 };
@@ -13,28 +13,31 @@
   #include <arpa/inet.h>
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
 class MuxerTestSocket : public AbstractSocket {
  public:
   enum State {
-    Type = 0,
-    Size,
+    Header = 0,
     Payload
   };
 
   MuxerTestSocket(int testPayloadSize)
-      : m_testPayloadSize(testPayloadSize), m_totalBytes(0), m_expected(Type) {}
+      : m_testPayloadSize(testPayloadSize), m_totalBytes(0), m_expected(Header) {}
 
   void setBlocking(bool) {}
 
-  void checkType(const char* data, std::size_t size) {
-    BOOST_CHECK_EQUAL(sizeof(uint32_t), size);
+  /// The type and size words are written together:
+  void checkHeader(const char* data, std::size_t size) {
+    BOOST_CHECK_EQUAL(2 * sizeof(uint32_t), size);
     uint32_t type = ntohl(*reinterpret_cast<const uint32_t*>(data));
     m_type        = static_cast<IdManager::PacketType>(type);
-  }
 
-  void checkSize(const char* data, std::size_t size) {
-    BOOST_CHECK_EQUAL(sizeof(uint32_t), size);
-    uint32_t payloadSize = ntohl(*reinterpret_cast<const uint32_t*>(data));
+    uint32_t payloadSize = ntohl(*reinterpret_cast<const uint32_t*>(data + sizeof(uint32_t)));
     if (m_type > 1) {
       BOOST_CHECK_EQUAL(m_testPayloadSize, payloadSize);
     }
@@ -49,17 +52,13 @@ class MuxerTestSocket : public AbstractSocket {
 
   int write(const char* data, std::size_t size) {
     switch (m_expected) {
-      case Type:
-        checkType(data, size);
-        m_expected = Size;
-        break;
-      case Size:
-        checkSize(data, size);
+      case Header:
+        checkHeader(data, size);
         m_expected = Payload;
         break;
       case Payload:
         checkPayload(data, size);
-        m_expected = Type;
+        m_expected = Header;
         break;
       default:
         BOOST_FAIL("MuxerTestSocket write fail");
@@ -88,6 +87,87 @@ class MuxerTestSocket : public AbstractSocket {
   IdManager::PacketType m_type;
 };
 
+/**
+    Mock socket that implements gather writes and records the byte stream
+    so that the framing can be checked independently of how the muxer
+    breaks down its writes.
+*/
+class GatherTestSocket : public AbstractSocket {
+ public:
+  GatherTestSocket()
+      : m_writeCalls(0), m_writevCalls(0), m_writevBuffers(0), m_open(true), m_stalled(false) {}
+
+  void setBlocking(bool) {}
+
+  int write(const char* data, std::size_t size) {
+    m_writeCalls += 1;
+    m_bytes.insert(m_bytes.end(), data, data + size);
+    return size;
+  }
+
+  int writev(const WriteBuffer* buffers, std::size_t count) {
+    // Behaves like a full non-blocking socket while closed so tests can control what is queued:
+    m_writevCalls += 1;
+    m_writevBuffers += count;
+    if (!m_open) {
+      m_stalled = true;
+      return 0;
+    }
+    int total = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+      m_bytes.insert(m_bytes.end(), buffers[i].data, buffers[i].data + buffers[i].size);
+      total += buffers[i].size;
+    }
+    return total;
+  }
+
+  bool readyForWriting(int milliseconds) const {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+    while (!m_open && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return m_open;
+  }
+
+  int read(char*, std::size_t) { return -1; }
+  bool readyForReading(int) const { return false; }
+
+  /// Split the recorded byte stream back into (type, payload-size) pairs:
+  std::vector<std::pair<uint32_t, uint32_t>> frames() const {
+    std::vector<std::pair<uint32_t, uint32_t>> result;
+    std::size_t pos = 0;
+    while (pos + 2 * sizeof(uint32_t) <= m_bytes.size()) {
+      const uint32_t type = ntohl(*reinterpret_cast<const uint32_t*>(&m_bytes[pos]));
+      const uint32_t size = ntohl(*reinterpret_cast<const uint32_t*>(&m_bytes[pos + sizeof(uint32_t)]));
+      result.emplace_back(type, size);
+      pos += 2 * sizeof(uint32_t) + size;
+    }
+    BOOST_CHECK_EQUAL(pos, m_bytes.size());
+    return result;
+  }
+
+  /// The payloads of all the recorded packets of one type:
+  std::vector<std::vector<char>> payloads(uint32_t type) const {
+    std::vector<std::vector<char>> result;
+    std::size_t pos = 0;
+    for (const auto& frame : frames()) {
+      pos += 2 * sizeof(uint32_t);
+      if (frame.first == type) {
+        result.emplace_back(m_bytes.begin() + pos, m_bytes.begin() + pos + frame.second);
+      }
+      pos += frame.second;
+    }
+    return result;
+  }
+
+  int m_writeCalls;
+  std::atomic<int> m_writevCalls;
+  std::atomic<int> m_writevBuffers;
+  std::atomic<bool> m_open;
+  std::atomic<bool> m_stalled;
+  std::vector<char> m_bytes;
+};
+
 class DemuxerTestSocket : public AbstractSocket {
  public:
   DemuxerTestSocket(){};
@@ -99,6 +179,57 @@ class DemuxerTestSocket : public AbstractSocket {
   virtual bool readyForReading(int) const { return true; };
 };
 
+/**
+    Mock socket that serves a preset byte stream to a demuxer, but only once
+    open() has been called (so subscribers can be registered first). Counts the
+    number of calls to read(). After hangUp() it reports being readable at the
+    end of the stream, like a socket whose peer has closed.
+*/
+class StreamTestSocket : public AbstractSocket {
+ public:
+  StreamTestSocket()
+      : m_open(false), m_hungUp(false), m_pos(0), m_readCalls(0) {}
+
+  /// Append a packet to the stream using the muxer's wire format:
+  void appendPacket(uint32_t type, const std::vector<char>& payload) {
+    const uint32_t header[2] = {htonl(type), htonl(static_cast<uint32_t>(payload.size()))};
+    const char* bytes        = reinterpret_cast<const char*>(header);
+    m_bytes.insert(m_bytes.end(), bytes, bytes + sizeof(header));
+    m_bytes.insert(m_bytes.end(), payload.begin(), payload.end());
+  }
+
+  void open() { m_open = true; }
+  void hangUp() { m_hungUp = true; }
+
+  void setBlocking(bool) {}
+  int write(const char*, std::size_t size) { return size; }
+
+  int read(char* data, std::size_t size) {
+    m_readCalls += 1;
+    if (!m_open) {
+      return 0;
+    }
+    const std::size_t n = std::min(size, m_bytes.size() - m_pos);
+    std::copy(m_bytes.begin() + m_pos, m_bytes.begin() + m_pos + n, data);
+    m_pos += n;
+    return n;
+  }
+
+  bool readyForReading(int milliseconds) const {
+    if (m_open && (m_pos < m_bytes.size() || m_hungUp)) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(std::min(milliseconds, 10)));
+    return false;
+  }
+
+  std::atomic<bool> m_open;
+  std::atomic<bool> m_hungUp;
+  std::vector<char> m_bytes;
+  std::size_t m_pos;
+  std::atomic<int> m_readCalls;
+};
+
 /**
     This mock socket always reports being ready to read, and always
     reports an io error(returns -1) if read() or write() are called.
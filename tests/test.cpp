@@ -10,7 +10,13 @@
 
 #include "../src/ComPacket.h"
 #include "../src/IdManager.h"
+#include "../src/LatencyHistogram.h"
+#include "../src/MpscQueue.h"
 #include "../src/PacketComms.h"
+#include "../src/PacketSerialisation.h"
+#include "../src/Protocol.h"
+#include "../src/Reactor.h"
+#include "../src/TcpServer.h"
 #include "../src/VectorStream.h"
 #include "../src/network/Ipv4Address.h"
 #include "../src/network/Socket.h"
@@ -25,8 +31,11 @@
   #include <chrono>
 #else
   #include <pthread.h>
+  #include <sys/socket.h>
   #include <unistd.h>
 #endif
+#include <algorithm>
+#include <map>
 #include <memory>
 
 struct Type1 {
@@ -78,14 +87,13 @@ BOOST_AUTO_TEST_CASE(TestVectorStream) {
   Type1 out1;
   Type1 out2;
   {
-    const VectorStream::Buffer& buffer = pkt.getData();
-    const size_t sizeBefore            = buffer.size();
-    VectorInputStream vsIn(buffer);
+    const size_t sizeBefore = pkt.getDataSize();
+    VectorInputStream vsIn(pkt.getDataPtr(), pkt.getDataSize());
     std::istream achiveInputStream(&vsIn);
     cereal::PortableBinaryInputArchive archive(achiveInputStream);
     int intOut = 0;
     archive(out1, intOut, out2, out3);
-    const size_t sizeAfter = buffer.size();
+    const size_t sizeAfter = pkt.getDataSize();
     BOOST_CHECK_EQUAL(intOut, intIn);
     // Need to check because VectorInputStream uses const cast inside
     BOOST_CHECK_EQUAL(sizeBefore, sizeAfter);
@@ -119,6 +127,30 @@ BOOST_AUTO_TEST_CASE(TestIdManager) {
   BOOST_CHECK_EQUAL("Type1", packetIds.toString(ctrl + 1));
   BOOST_CHECK_EQUAL("Type2", packetIds.toString(ctrl + 2));
   BOOST_CHECK_EQUAL("Type3", packetIds.toString(ctrl + 3));
+
+  BOOST_CHECK_THROW(packetIds.toId("Type4"), std::out_of_range);
+  BOOST_CHECK_THROW(packetIds.toId(""), std::out_of_range);
+  BOOST_CHECK_THROW(packetIds.toString(ctrl + 4), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(TestIdManagerManyTypes) {
+  std::vector<std::string> names;
+  for (int i = 0; i < 500; ++i) {
+    names.push_back("Packet" + std::to_string(i));
+  }
+  IdManager packetIds(names);
+  BOOST_CHECK_EQUAL(names.size() + 2, packetIds.size());
+
+  for (std::size_t i = 0; i < names.size(); ++i) {
+    const std::string_view name(names[i]);
+    const IdManager::PacketType id = packetIds.toId(name);
+    BOOST_CHECK_EQUAL(IdManager::ControlPacket + 1 + i, id);
+    BOOST_CHECK_EQUAL(names[i], packetIds.toString(id));
+  }
+
+  // A prefix of a stored name must not match:
+  BOOST_CHECK_THROW(packetIds.toId(std::string_view(names[123]).substr(0, 5)), std::out_of_range);
+  BOOST_CHECK_THROW(packetIds.toId("Packet500"), std::out_of_range);
 }
 
 BOOST_AUTO_TEST_CASE(TestComPacket) {
@@ -135,7 +167,7 @@ BOOST_AUTO_TEST_CASE(TestComPacket) {
 
   // Test packet contains the byte data:
   for (int i = 0; i < size; ++i) {
-    BOOST_CHECK_EQUAL(bytes[i], pkt2.getData()[i]);
+    BOOST_CHECK_EQUAL(bytes[i], pkt2.getDataPtr()[i]);
   }
 
   // Create an Odometry packet with uninitialised data:
@@ -159,6 +191,147 @@ BOOST_AUTO_TEST_CASE(TestComPacket) {
   BOOST_CHECK_EQUAL(IdManager::InvalidPacket, pkt2.getType());
 }
 
+BOOST_AUTO_TEST_CASE(TestInlineComPacket) {
+  // Small payloads live inside the packet:
+  VectorStream::CharType small[] = "ping";
+  ComPacket a(IdManager::ControlPacket, small, sizeof(small));
+  BOOST_CHECK_EQUAL(ComPacket::fitsInline(sizeof(small)), a.isInline());
+  BOOST_CHECK_EQUAL(sizeof(small), a.getDataSize());
+  BOOST_CHECK_EQUAL(std::string(small), std::string(a.getDataPtr()));
+
+  // Large payloads do not:
+  std::vector<VectorStream::CharType> large(ComPacket::InlineCapacity + 1, 'x');
+  ComPacket b(IdManager::ControlPacket, large.data(), large.size());
+  BOOST_CHECK(!b.isInline());
+  BOOST_CHECK(std::equal(large.begin(), large.end(), b.getDataPtr()));
+
+  // Moving an inline packet must re-point the data at the new packet:
+  ComPacket c(std::move(a));
+  BOOST_CHECK_EQUAL(ComPacket::fitsInline(sizeof(small)), c.isInline());
+  BOOST_CHECK_EQUAL(std::string(small), std::string(c.getDataPtr()));
+  BOOST_CHECK_EQUAL(nullptr, a.getDataPtr());
+  BOOST_CHECK_EQUAL(0, a.getDataSize());
+
+  // Swapping inline and heap payloads in both directions:
+  std::swap(b, c);
+  BOOST_CHECK_EQUAL(ComPacket::fitsInline(sizeof(small)), b.isInline());
+  BOOST_CHECK(!c.isInline());
+  BOOST_CHECK_EQUAL(std::string(small), std::string(b.getDataPtr()));
+  BOOST_CHECK_EQUAL(large.size(), c.getDataSize());
+  BOOST_CHECK(std::equal(large.begin(), large.end(), c.getDataPtr()));
+
+  // Two inline packets:
+  VectorStream::CharType other[] = "pong!";
+  ComPacket d(IdManager::ControlPacket, other, sizeof(other));
+  std::swap(b, d);
+  BOOST_CHECK_EQUAL(std::string(other), std::string(b.getDataPtr()));
+  BOOST_CHECK_EQUAL(std::string(small), std::string(d.getDataPtr()));
+  BOOST_CHECK_EQUAL(sizeof(other), b.getDataSize());
+
+  // Preallocated small packets are zeroed like the vector version:
+  ComPacket e(IdManager::ControlPacket, 8);
+  BOOST_CHECK_EQUAL(ComPacket::fitsInline(8), e.isInline());
+  BOOST_CHECK(std::all_of(e.getDataPtr(), e.getDataPtr() + 8, [](VectorStream::CharType v) { return v == 0; }));
+}
+
+BOOST_AUTO_TEST_CASE(TestExternalComPacket) {
+  VectorStream::CharType frame[64] = "external";
+  int releases                     = 0;
+  {
+    ComPacket pkt(IdManager::ControlPacket, frame, sizeof(frame), [&]() { releases += 1; });
+    BOOST_CHECK(pkt.isExternal());
+    BOOST_CHECK(frame == pkt.getDataPtr());  // Not copied
+    BOOST_CHECK_EQUAL(sizeof(frame), pkt.getDataSize());
+
+    ComPacket moved(std::move(pkt));
+    BOOST_CHECK(frame == moved.getDataPtr());
+    BOOST_CHECK_EQUAL(0, pkt.getDataSize());
+    BOOST_CHECK_EQUAL(0, releases);
+  }
+  BOOST_CHECK_EQUAL(1, releases);
+
+  // Shared owner variant:
+  auto owner = std::make_shared<std::vector<VectorStream::CharType>>(16, 'z');
+  {
+    ComPacket pkt(IdManager::ControlPacket, owner, owner->data(), owner->size());
+    BOOST_CHECK_EQUAL(2, owner.use_count());
+    BOOST_CHECK(owner->data() == pkt.getDataPtr());
+  }
+  BOOST_CHECK_EQUAL(1, owner.use_count());
+
+  // Muxer writes straight from the external memory and releases it once it has been sent:
+  GatherTestSocket socket;
+  std::atomic<int> muxReleases(0);
+  {
+    PacketMuxer muxer(socket, {"Frame"});
+    muxer.emplacePacket("Frame", frame, sizeof(frame), [&]() { muxReleases += 1; });
+    while (muxReleases == 0) {
+      std::this_thread::yield();
+    }
+  }
+  const auto payloads = socket.payloads(IdManager::ControlPacket + 1);
+  BOOST_REQUIRE_EQUAL(1, payloads.size());
+  BOOST_CHECK(std::equal(payloads[0].begin(), payloads[0].end(), frame));
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketBufferPool) {
+  auto pool = std::make_shared<PacketBufferPool>();
+
+  // Warm up the pool:
+  const VectorStream::CharType* first = nullptr;
+  {
+    auto sptr = pool->share(ComPacket(IdManager::ControlPacket, pool->allocateBuffer(1000)));
+    BOOST_CHECK_EQUAL(1000, sptr->getDataSize());
+    first = sptr->getDataPtr();
+  }
+  const auto heapAllocations = pool->getNumHeapAllocations();
+  BOOST_CHECK_EQUAL(2, heapAllocations);  // Payload and packet (including control block)
+
+  // Steady state re-uses the same memory without going to the heap:
+  for (int i = 0; i < 100; ++i) {
+    ComPacket::ConstSharedPacket sptr = pool->share(ComPacket(IdManager::ControlPacket, pool->allocateBuffer(900 + i)));
+    BOOST_CHECK(first == sptr->getDataPtr());
+  }
+  BOOST_CHECK_EQUAL(heapAllocations, pool->getNumHeapAllocations());
+
+  // Outstanding packets keep the pool alive:
+  std::weak_ptr<PacketBufferPool> weakPool = pool;
+  auto sptr                                = pool->share(ComPacket(IdManager::ControlPacket, pool->allocateBuffer(10)));
+  pool.reset();
+  BOOST_CHECK(!weakPool.expired());
+  sptr.reset();
+  BOOST_CHECK(weakPool.expired());
+}
+
+BOOST_AUTO_TEST_CASE(TestLatencyHistogram) {
+  LatencyHistogram histogram;
+  BOOST_CHECK_EQUAL(0, histogram.summary().count);
+  BOOST_CHECK_EQUAL(0, histogram.percentile(50).count());
+
+  // 1us to 1ms in 1us steps:
+  for (int i = 1; i <= 1000; ++i) {
+    histogram.record(std::chrono::microseconds(i));
+  }
+  const LatencySummary summary = histogram.summary();
+  BOOST_CHECK_EQUAL(1000, summary.count);
+  BOOST_CHECK_EQUAL(std::chrono::nanoseconds(std::chrono::milliseconds(1)).count(), summary.max.count());
+
+  // Within the bucket resolution of about 3%:
+  BOOST_CHECK_CLOSE(500000.0, double(summary.p50.count()), 3.5);
+  BOOST_CHECK_CLOSE(990000.0, double(summary.p99.count()), 3.5);
+  BOOST_CHECK_CLOSE(999000.0, double(summary.p999.count()), 3.5);
+  BOOST_CHECK(summary.p50 <= summary.p99);
+  BOOST_CHECK(summary.p999 <= summary.max);
+
+  // Small values are exact and huge values are clamped rather than lost:
+  LatencyHistogram small;
+  small.record(std::chrono::nanoseconds(7));
+  BOOST_CHECK_EQUAL(7, small.percentile(100).count());
+  small.record(std::chrono::hours(1));
+  BOOST_CHECK_EQUAL(2, small.count());
+  BOOST_CHECK_EQUAL(std::chrono::nanoseconds(std::chrono::hours(1)).count(), small.summary().max.count());
+}
+
 BOOST_AUTO_TEST_CASE(TestSimpleQueue) {
   SimpleQueue q;
 
@@ -210,6 +383,40 @@ BOOST_AUTO_TEST_CASE(TestSimpleQueue) {
   sptr2.reset();
 }
 
+BOOST_AUTO_TEST_CASE(TestMpscQueue) {
+  MpscQueue<int> q;
+  BOOST_CHECK(q.empty());
+
+  constexpr int numProducers = 4;
+  constexpr int numItems     = 10000;
+  std::vector<std::thread> producers;
+  for (int p = 0; p < numProducers; ++p) {
+    producers.emplace_back([&q, p]() {
+      for (int i = 0; i < numItems; ++i) {
+        q.push(p * numItems + i);
+      }
+    });
+  }
+
+  // Items from each producer must be popped in the order they were pushed:
+  std::vector<int> last(numProducers, -1);
+  int count = 0;
+  while (count < numProducers * numItems) {
+    int item = 0;
+    if (q.pop(item)) {
+      const int p = item / numItems;
+      BOOST_REQUIRE_GT(item, last[p]);
+      last[p] = item;
+      count += 1;
+    }
+  }
+
+  for (auto& t : producers) {
+    t.join();
+  }
+  BOOST_CHECK(q.empty());
+}
+
 BOOST_AUTO_TEST_CASE(TestPacketMuxerExitsCleanly) {
   AlwaysFailSocket mockSocket;
   PacketMuxer muxer(mockSocket, {});
@@ -249,6 +456,681 @@ BOOST_AUTO_TEST_CASE(TestPacketMuxer) {
   BOOST_CHECK_EQUAL(muxer.getNumPosted(), muxer.getNumSent());
 }
 
+BOOST_AUTO_TEST_CASE(TestPacketMuxerGatherWrite) {
+  constexpr int numPackets = 50;
+  constexpr int payloadSize = 5;
+  GatherTestSocket socket;
+  {
+    // Drive the muxer from the test so every packet is queued before the first write:
+    MuxerOptions options;
+    options.sendThread = false;
+    PacketMuxer muxer(socket, {"MockPacket"}, options);
+    VectorStream::CharType payload[payloadSize] = "abcd";
+    for (int i = 0; i < numPackets; ++i) {
+      muxer.emplacePacket("MockPacket", payload, payloadSize);
+    }
+
+    while (muxer.flush()) {
+    }
+    BOOST_CHECK_EQUAL(muxer.getNumPosted(), muxer.getNumSent());
+  }
+
+  // All writes go through the gather path, many packets per call, with one buffer per header:
+  BOOST_CHECK_EQUAL(0, socket.m_writeCalls);
+  BOOST_CHECK_LE(socket.m_writevCalls, 2);
+  BOOST_CHECK_EQUAL(2 * (numPackets + 1), socket.m_writevBuffers);  // Including the 'Hello' message.
+
+  int count = 0;
+  for (const auto& frame : socket.frames()) {
+    if (frame.first != IdManager::ControlPacket) {
+      BOOST_CHECK_EQUAL(payloadSize, frame.second);
+      count += 1;
+    }
+  }
+  BOOST_CHECK_EQUAL(numPackets, count);
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketMuxerZeroQuantum) {
+  GatherTestSocket socket;
+  MuxerOptions options;
+  options.channels["Bulk"].quantum = 0;
+  BOOST_CHECK_THROW(PacketMuxer(socket, {"Bulk"}, options), std::invalid_argument);
+
+  // Priority types do not use their quantum:
+  options.channels["Bulk"].scheduling = Scheduling::Priority;
+  PacketMuxer muxer(socket, {"Bulk"}, options);
+  BOOST_CHECK(muxer.ok());
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketMuxerScheduling) {
+  MuxerOptions options;
+  options.channels["Command"]            = {Scheduling::Priority, 1};
+  options.channels["BulkA"].quantum      = 2000;
+  options.channels["BulkB"].quantum      = 2000;
+  const std::vector<std::string> packets = {"BulkA", "BulkB", "Command"};
+  IdManager ids(packets);
+
+  GatherTestSocket socket;
+  socket.m_open = false;
+  {
+    PacketMuxer muxer(socket, packets, options);
+
+    // Everything is queued while the transport is stalled:
+    std::vector<VectorStream::CharType> bulk(1000);
+    for (int i = 0; i < 10; ++i) {
+      muxer.emplacePacket("BulkA", bulk.data(), bulk.size());
+    }
+    for (int i = 0; i < 10; ++i) {
+      muxer.emplacePacket("BulkB", bulk.data(), bulk.size());
+    }
+    VectorStream::CharType command = 1;
+    muxer.emplacePacket("Command", &command, 1);
+
+    socket.m_open = true;
+    while (muxer.getNumSent() != muxer.getNumPosted()) {
+      std::this_thread::yield();
+    }
+  }
+
+  std::vector<uint32_t> order;
+  for (const auto& frame : socket.frames()) {
+    if (frame.first != IdManager::ControlPacket) {
+      order.push_back(frame.first);
+    }
+  }
+  BOOST_REQUIRE_EQUAL(21, order.size());
+
+  // Priority packet overtakes the bulk packets:
+  BOOST_CHECK_EQUAL(ids.toId("Command"), order.front());
+
+  // Bulk types are interleaved two packets at a time instead of one draining before the other:
+  for (std::size_t i = 1; i < order.size(); ++i) {
+    const uint32_t expected = ((i - 1) / 2) % 2 == 0 ? ids.toId("BulkA") : ids.toId("BulkB");
+    BOOST_CHECK_EQUAL(expected, order[i]);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketFragmentation) {
+  MuxerOptions options;
+  options.maxFragmentSize                = 1000;
+  options.channels["Command"]            = {Scheduling::Priority, 1};
+  options.channels["BulkA"].quantum      = 1000;
+  options.channels["BulkB"].quantum      = 1000;
+  const std::vector<std::string> packets = {"BulkA", "BulkB", "Command"};
+  IdManager ids(packets);
+
+  std::map<std::string, std::vector<VectorStream::CharType>> sent;
+  for (int i = 0; i < 4500; ++i) {
+    sent["BulkA"].push_back(static_cast<VectorStream::CharType>(i));
+  }
+  for (int i = 0; i < 2500; ++i) {
+    sent["BulkB"].push_back(static_cast<VectorStream::CharType>(i * 7));
+  }
+  sent["Command"] = {1};
+
+  // Drive the muxer from the test so everything is queued before the first frame is chosen:
+  options.sendThread = false;
+  GatherTestSocket socket;
+  {
+    PacketMuxer muxer(socket, packets, options);
+    for (const auto& name : {"BulkA", "BulkB", "Command"}) {
+      muxer.emplacePacket(name, sent[name].data(), sent[name].size());
+    }
+    while (muxer.flush()) {
+    }
+    BOOST_CHECK_EQUAL(muxer.getNumPosted(), muxer.getNumSent());
+  }
+
+  std::vector<std::pair<uint32_t, uint32_t>> frames;
+  for (const auto& frame : socket.frames()) {
+    if (frame.first != IdManager::ControlPacket) {
+      frames.push_back(frame);
+    }
+  }
+
+  // Fragments of the two bulk types are interleaved and the flag is clear on each type's last fragment:
+  const uint32_t a = ids.toId("BulkA");
+  const uint32_t b = ids.toId("BulkB");
+  const uint32_t more = MoreFragmentsFlag;
+  const std::vector<std::pair<uint32_t, uint32_t>> expected = {
+      {ids.toId("Command"), 1}, {a | more, 1000}, {b | more, 1000}, {a | more, 1000}, {b | more, 1000},
+      {a | more, 1000},         {b, 500},         {a | more, 1000}, {a, 500}};
+  BOOST_REQUIRE_EQUAL(expected.size(), frames.size());
+  for (std::size_t i = 0; i < expected.size(); ++i) {
+    BOOST_CHECK_EQUAL(expected[i].first, frames[i].first);
+    BOOST_CHECK_EQUAL(expected[i].second, frames[i].second);
+  }
+
+  // Demuxer reassembles the original packets:
+  StreamTestSocket stream;
+  stream.m_bytes = socket.m_bytes;
+  PacketDemuxer demuxer(stream, packets);
+  std::mutex lock;
+  std::map<std::string, std::vector<VectorStream::CharType>> received;
+  std::vector<PacketSubscription> subscriptions;
+  for (const auto& name : packets) {
+    subscriptions.push_back(demuxer.subscribe(name, [&, name](const ComPacket::ConstSharedPacket& packet) {
+      std::lock_guard<std::mutex> guard(lock);
+      received[name].assign(packet->getDataPtr(), packet->getDataPtr() + packet->getDataSize());
+    }));
+  }
+  stream.open();
+  auto complete = [&]() {
+    std::lock_guard<std::mutex> guard(lock);
+    return received.size() == sent.size();
+  };
+  while (!complete()) {
+    std::this_thread::yield();
+  }
+  BOOST_CHECK(received == sent);
+  BOOST_CHECK(demuxer.ok());
+}
+
+BOOST_AUTO_TEST_CASE(TestTypedChannels) {
+  const std::vector<std::string> packets = {"Raw", "Type1"};
+  IdManager ids(packets);
+  BOOST_CHECK_THROW(Channel<>(ids, "Unknown"), std::out_of_range);
+  BOOST_CHECK(!Channel<>().valid());
+
+  GatherTestSocket socket;
+  {
+    PacketMuxer muxer(socket, packets);
+    const Channel<> raw(muxer.getIdManager(), "Raw");
+    const Channel<Type1> typed(muxer.getIdManager(), "Type1");
+    BOOST_CHECK_EQUAL(ids.toId("Raw"), raw.id());
+
+    VectorStream::CharType byte = 42;
+    BOOST_CHECK(muxer.emplacePacket(raw, &byte, 1));
+    BOOST_CHECK(serialise(muxer, typed, Type1{1, 2, 3}));
+    BOOST_CHECK(serialise(muxer, typed, Type1{4, 5, 6}));
+    while (muxer.getNumSent() != muxer.getNumPosted()) {
+      std::this_thread::yield();
+    }
+  }
+
+  StreamTestSocket stream;
+  stream.m_bytes = socket.m_bytes;
+  PacketDemuxer demuxer(stream, packets);
+  std::atomic<int> rawCount(0);
+  std::vector<Type1> values;
+  std::mutex lock;
+  auto rawSubscription = demuxer.subscribe(Channel<>(demuxer.getIdManager(), "Raw"), [&](const ComPacket::ConstSharedPacket& packet) {
+    BOOST_CHECK_EQUAL(42, packet->getDataPtr()[0]);
+    rawCount += 1;
+  });
+  auto typedSubscription = subscribe(demuxer, Channel<Type1>(demuxer.getIdManager(), "Type1"), [&](const Type1& value) {
+    std::lock_guard<std::mutex> guard(lock);
+    values.push_back(value);
+  });
+
+  stream.open();
+  auto received = [&]() {
+    std::lock_guard<std::mutex> guard(lock);
+    return values.size() == 2 && rawCount == 1;
+  };
+  while (!received()) {
+    std::this_thread::yield();
+  }
+  BOOST_CHECK_EQUAL(1, values[0].axis1);
+  BOOST_CHECK_EQUAL(3, values[0].max);
+  BOOST_CHECK_EQUAL(4, values[1].axis1);
+  BOOST_CHECK_EQUAL(6, values[1].max);
+}
+
+struct PoseTag {
+  static constexpr const char* PacketName = "Pose";
+  typedef Type1 ValueType;
+};
+struct StatusTag {
+  static constexpr const char* PacketName = "Status";
+};
+typedef Protocol<PoseTag, StatusTag> ExampleProtocol;
+
+// Ids and channels are compile time constants:
+static_assert(ExampleProtocol::id<PoseTag>() == IdManager::ControlPacket + 1, "");
+static_assert(ExampleProtocol::id("Status") == ExampleProtocol::id<StatusTag>(), "");
+static_assert(std::is_same<decltype(ExampleProtocol::channel<PoseTag>()), Channel<Type1>>::value, "");
+static_assert(ExampleProtocol::channel<StatusTag>().id() == IdManager::ControlPacket + 2, "");
+
+BOOST_AUTO_TEST_CASE(TestProtocol) {
+  // Agrees with the ids assigned at runtime:
+  IdManager ids(ExampleProtocol::names());
+  BOOST_CHECK_EQUAL(ids.toId("Pose"), ExampleProtocol::id<PoseTag>());
+  BOOST_CHECK_EQUAL(ids.toId("Status"), ExampleProtocol::id<StatusTag>());
+  BOOST_CHECK_THROW(ExampleProtocol::id("Unknown"), std::out_of_range);
+
+  struct Handler {
+    void operator()(Channel<Type1>, const ComPacket::ConstSharedPacket&) { poses += 1; }
+    void operator()(Channel<StatusTag>, const ComPacket::ConstSharedPacket&) { statuses += 1; }
+    int poses    = 0;
+    int statuses = 0;
+  } handler;
+
+  auto pose   = std::make_shared<const ComPacket>(ExampleProtocol::id<PoseTag>(), 1);
+  auto status = std::make_shared<const ComPacket>(ExampleProtocol::id<StatusTag>(), 1);
+  auto other  = std::make_shared<const ComPacket>(IdManager::ControlPacket, 1);
+  BOOST_CHECK(ExampleProtocol::dispatch(pose, handler));
+  BOOST_CHECK(ExampleProtocol::dispatch(status, handler));
+  BOOST_CHECK(ExampleProtocol::dispatch(status, handler));
+  BOOST_CHECK(!ExampleProtocol::dispatch(other, handler));
+  BOOST_CHECK_EQUAL(1, handler.poses);
+  BOOST_CHECK_EQUAL(2, handler.statuses);
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketMuxerQueueLimits) {
+  MuxerOptions options;
+  options.channels["Fail"]   = {Scheduling::FairShare, 0, 1024, 2, 0, Overflow::Fail};
+  options.channels["Newest"] = {Scheduling::FairShare, 0, 1024, 2, 0, Overflow::DropNewest};
+  options.channels["Oldest"] = {Scheduling::FairShare, 0, 1024, 0, 2, Overflow::DropOldest};
+  options.channels["Block"]  = {Scheduling::FairShare, 0, 1024, 1, 0, Overflow::Block};
+  const std::vector<std::string> packets = {"Fail", "Newest", "Oldest", "Block"};
+  IdManager ids(packets);
+
+  GatherTestSocket socket;
+  socket.m_open = false;
+  {
+    PacketMuxer muxer(socket, packets, options);
+    // Wait until the send thread is stuck writing the hello message:
+    while (!socket.m_stalled) {
+      std::this_thread::yield();
+    }
+
+    for (VectorStream::CharType i = 0; i < 5; ++i) {
+      BOOST_CHECK_EQUAL(i < 2, muxer.emplacePacket("Fail", &i, 1));
+      BOOST_CHECK_EQUAL(i < 2, muxer.emplacePacket("Newest", &i, 1));
+      BOOST_CHECK(muxer.emplacePacket("Oldest", &i, 1));
+    }
+    BOOST_CHECK_EQUAL(0, muxer.getNumDropped("Fail"));
+    BOOST_CHECK_EQUAL(3, muxer.getNumDropped("Newest"));
+
+    VectorStream::CharType block = 0;
+    BOOST_CHECK(muxer.emplacePacket("Block", &block, 1));
+    std::atomic<bool> blocked(true);
+    std::thread producer([&]() {
+      muxer.emplacePacket("Block", &block, 1);
+      blocked = false;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    BOOST_CHECK(blocked);
+
+    socket.m_open = true;
+    producer.join();
+    while (muxer.getNumSent() + muxer.getNumDropped("Oldest") != muxer.getNumPosted()) {
+      std::this_thread::yield();
+    }
+    BOOST_CHECK_EQUAL(3, muxer.getNumDropped("Oldest"));
+    BOOST_CHECK_EQUAL(6, muxer.getNumDropped());
+  }
+
+  std::map<uint32_t, int> counts;
+  for (const auto& frame : socket.frames()) {
+    counts[frame.first] += 1;
+  }
+  BOOST_CHECK_EQUAL(2, counts[ids.toId("Fail")]);
+  BOOST_CHECK_EQUAL(2, counts[ids.toId("Newest")]);
+  BOOST_CHECK_EQUAL(2, counts[ids.toId("Oldest")]);
+  BOOST_CHECK_EQUAL(2, counts[ids.toId("Block")]);
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketMuxerByteBudget) {
+  MuxerOptions options;
+  options.maxQueuedBytes                 = 301;  // Includes the 1 byte 'Hello' message.
+  options.channels["Bulk"]               = {Scheduling::FairShare, 0, 1024, 0, 0, Overflow::Fail};
+  options.channels["Oldest"]             = {Scheduling::FairShare, 0, 1024, 2, 0, Overflow::DropOldest};
+  const std::vector<std::string> packets = {"Bulk", "Oldest"};
+  IdManager ids(packets);
+
+  GatherTestSocket socket;
+  socket.m_open = false;
+  {
+    PacketMuxer muxer(socket, packets, options);
+    while (!socket.m_stalled) {
+      std::this_thread::yield();
+    }
+
+    for (VectorStream::CharType i = 0; i < 2; ++i) {
+      BOOST_CHECK(muxer.emplacePacket("Oldest", &i, 1));
+    }
+    const std::vector<VectorStream::CharType> payload(149);
+    BOOST_CHECK(muxer.emplacePacket("Bulk", payload.data(), payload.size()));
+    BOOST_CHECK(muxer.emplacePacket("Bulk", payload.data(), payload.size()));
+    BOOST_CHECK(!muxer.emplacePacket("Bulk", payload.data(), payload.size()));
+
+    // Other types' backlog does not empty a DropOldest queue: the new packet is dropped instead:
+    VectorStream::CharType byte = 2;
+    BOOST_CHECK(!muxer.emplacePacket("Oldest", &byte, 1));
+    BOOST_CHECK_EQUAL(1, muxer.getNumDropped("Oldest"));
+
+    socket.m_open = true;
+    while (muxer.getNumSent() != muxer.getNumPosted()) {
+      std::this_thread::yield();
+    }
+  }
+
+  const auto oldest = socket.payloads(ids.toId("Oldest"));
+  BOOST_REQUIRE_EQUAL(2, oldest.size());
+  BOOST_CHECK_EQUAL(0, oldest[0].at(0));
+  BOOST_CHECK_EQUAL(1, oldest[1].at(0));
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketMuxerOversizedPacket) {
+  MuxerOptions options;
+  options.maxQueuedBytes                 = 1000;
+  options.channels["Block"]              = {Scheduling::FairShare, 0, 1024, 0, 100, Overflow::Block};
+  options.channels["Oldest"]             = {Scheduling::FairShare, 0, 1024, 0, 100, Overflow::DropOldest};
+  const std::vector<std::string> packets = {"Block", "Oldest", "Other"};
+  IdManager ids(packets);
+
+  GatherTestSocket socket;
+  {
+    PacketMuxer muxer(socket, packets, options);
+    const std::vector<VectorStream::CharType> large(200);
+    const std::vector<VectorStream::CharType> huge(2000);
+    VectorStream::CharType byte = 1;
+
+    // A packet over its type's limit on its own is dropped rather than blocking forever:
+    BOOST_CHECK(!muxer.emplacePacket("Block", large.data(), large.size()));
+    BOOST_CHECK_EQUAL(1, muxer.getNumDropped("Block"));
+
+    // ... or rather than discarding the packets already queued (and then itself):
+    BOOST_CHECK(muxer.emplacePacket("Oldest", &byte, 1));
+    BOOST_CHECK(!muxer.emplacePacket("Oldest", large.data(), large.size()));
+    BOOST_CHECK_EQUAL(1, muxer.getNumDropped("Oldest"));
+
+    // The same applies to the muxer's byte budget:
+    BOOST_CHECK(!muxer.emplacePacket("Other", huge.data(), huge.size()));
+    BOOST_CHECK_EQUAL(1, muxer.getNumDropped("Other"));
+
+    while (muxer.getNumSent() != muxer.getNumPosted()) {
+      std::this_thread::yield();
+    }
+    BOOST_CHECK(muxer.ok());
+  }
+
+  const auto oldest = socket.payloads(ids.toId("Oldest"));
+  BOOST_REQUIRE_EQUAL(1, oldest.size());
+  BOOST_CHECK_EQUAL(1, oldest[0].size());
+  BOOST_CHECK(socket.payloads(ids.toId("Block")).empty());
+  BOOST_CHECK(socket.payloads(ids.toId("Other")).empty());
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketStats) {
+  MuxerOptions options;
+  options.channels["Newest"]             = {Scheduling::FairShare, 0, 1024, 2, 0, Overflow::DropNewest};
+  const std::vector<std::string> packets = {"Newest", "Bulk"};
+  IdManager ids(packets);
+  const uint32_t newest = ids.toId("Newest");
+  const uint32_t bulk   = ids.toId("Bulk");
+
+  GatherTestSocket socket;
+  socket.m_open = false;
+  {
+    PacketMuxer muxer(socket, packets, options);
+    while (!socket.m_stalled) {
+      std::this_thread::yield();
+    }
+
+    VectorStream::CharType byte = 0;
+    std::vector<VectorStream::CharType> payload(100);
+    for (int i = 0; i < 3; ++i) {
+      muxer.emplacePacket("Newest", &byte, 1);
+    }
+    for (int i = 0; i < 4; ++i) {
+      muxer.emplacePacket("Bulk", payload.data(), payload.size());
+    }
+
+    MuxerStats stats = muxer.getStats();
+    BOOST_REQUIRE_EQUAL(ids.size(), stats.types.size());
+    BOOST_CHECK_EQUAL("Newest", stats.types[newest].name);
+    BOOST_CHECK_EQUAL(2, stats.types[newest].posted);
+    BOOST_CHECK_EQUAL(1, stats.types[newest].dropped);
+    BOOST_CHECK_EQUAL(2, stats.types[newest].queueDepth);
+    BOOST_CHECK_EQUAL(4, stats.types[bulk].queueDepth);
+    BOOST_CHECK_EQUAL(0, stats.types[bulk].packets);
+    BOOST_CHECK_EQUAL(1, stats.writeStalls);
+    BOOST_CHECK_EQUAL(1, stats.types[IdManager::ControlPacket].writeStalls);
+
+    // Packets rejected by DropNewest were never posted:
+    socket.m_open = true;
+    while (muxer.getNumSent() != muxer.getNumPosted()) {
+      std::this_thread::yield();
+    }
+
+    stats = muxer.getStats();
+    BOOST_CHECK_EQUAL(4, stats.types[bulk].packets);
+    BOOST_CHECK_EQUAL(400, stats.types[bulk].bytes);
+    BOOST_CHECK_EQUAL(0, stats.types[bulk].queueDepth);
+    BOOST_CHECK_EQUAL(4, stats.types[bulk].queueHighWater);
+    BOOST_CHECK_EQUAL(2, stats.types[newest].packets);
+  }
+
+  // Demuxer counts what it receives from the same stream:
+  StreamTestSocket stream;
+  stream.m_bytes = socket.m_bytes;
+  PacketDemuxer demuxer(stream, packets);
+  stream.open();
+  while (demuxer.getStats().bytesRead != stream.m_bytes.size()) {
+    std::this_thread::yield();
+  }
+  while (demuxer.getStats().types[bulk].packets != 4) {
+    std::this_thread::yield();
+  }
+
+  const DemuxerStats stats = demuxer.getStats();
+  BOOST_CHECK_EQUAL(400, stats.types[bulk].bytes);
+  BOOST_CHECK_EQUAL(2, stats.types[newest].packets);
+  BOOST_CHECK_GE(stats.reads, 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketMuxerLatency) {
+  MuxerOptions options;
+  options.latencyHistograms              = true;
+  const std::vector<std::string> packets = {"Type1"};
+
+  GatherTestSocket socket;
+  socket.m_open = false;
+  {
+    PacketMuxer muxer(socket, packets, options);
+    while (!socket.m_stalled) {
+      std::this_thread::yield();
+    }
+    VectorStream::CharType byte = 0;
+    for (int i = 0; i < 10; ++i) {
+      muxer.emplacePacket("Type1", &byte, 1);
+    }
+
+    // Packets wait in the queue while the transport is stalled:
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    socket.m_open = true;
+    while (muxer.getNumSent() != muxer.getNumPosted()) {
+      std::this_thread::yield();
+    }
+
+    const LatencySummary queued = muxer.getQueueLatency("Type1");
+    BOOST_CHECK_EQUAL(10, queued.count);
+    BOOST_CHECK(queued.p50 >= std::chrono::milliseconds(40));
+    BOOST_CHECK(queued.p99 <= queued.max);
+    BOOST_CHECK_EQUAL(10, muxer.getWriteLatency("Type1").count);
+
+    // The hello message was stuck in the write itself:
+    BOOST_CHECK(muxer.getWriteLatency(IdManager::ControlString).max >= std::chrono::milliseconds(40));
+  }
+
+  // Disabled by default:
+  GatherTestSocket other;
+  PacketMuxer muxer(other, packets);
+  VectorStream::CharType byte = 0;
+  muxer.emplacePacket("Type1", &byte, 1);
+  BOOST_CHECK_EQUAL(0, muxer.getQueueLatency("Type1").count);
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketMuxerCoalescing) {
+  MuxerOptions options;
+  options.coalesceDelay                  = std::chrono::milliseconds(50);
+  options.coalescePackets                = 5;
+  const std::vector<std::string> packets = {"Type1"};
+
+  GatherTestSocket socket;
+  PacketMuxer muxer(socket, packets, options);
+  auto waitForSent = [&](uint32_t count) {
+    while (muxer.getNumSent() < count) {
+      std::this_thread::yield();
+    }
+  };
+
+  // Hello is held back until the deadline:
+  const auto start = std::chrono::steady_clock::now();
+  waitForSent(1);
+  BOOST_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(40));
+  BOOST_CHECK_EQUAL(1, socket.m_writevCalls);
+
+  // Reaching the packet threshold flushes everything in one write:
+  VectorStream::CharType byte = 0;
+  for (int i = 0; i < 5; ++i) {
+    muxer.emplacePacket("Type1", &byte, 1);
+  }
+  waitForSent(6);
+  BOOST_CHECK_EQUAL(2, socket.m_writevCalls);
+
+  // Fewer packets wait for the deadline and are then written together:
+  const auto posted = std::chrono::steady_clock::now();
+  muxer.emplacePacket("Type1", &byte, 1);
+  muxer.emplacePacket("Type1", &byte, 1);
+  waitForSent(8);
+  BOOST_CHECK(std::chrono::steady_clock::now() - posted >= std::chrono::milliseconds(40));
+  BOOST_CHECK_EQUAL(3, socket.m_writevCalls);
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketMuxerWriteStall) {
+  MuxerOptions options;
+  options.writeStallTimeout = std::chrono::milliseconds(200);
+  const std::vector<std::string> packets = {"Type1"};
+
+  GatherTestSocket socket;
+  socket.m_open = false;
+  PacketMuxer muxer(socket, packets, options);
+  VectorStream::CharType byte = 0;
+  muxer.emplacePacket("Type1", &byte, 1);
+
+  const auto start = std::chrono::steady_clock::now();
+  while (muxer.ok() && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  BOOST_CHECK(!muxer.ok());
+  BOOST_CHECK(muxer.stalled());
+  BOOST_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(150));
+
+  // The send thread sleeps while the transport is full rather than retrying the write:
+  BOOST_CHECK_LT(socket.m_writevCalls, 10);
+  BOOST_CHECK(!muxer.emplacePacket("Type1", &byte, 1));
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketMuxerConflation) {
+  MuxerOptions options;
+  options.channels["State"].conflate     = true;
+  const std::vector<std::string> packets = {"State", "Event"};
+  IdManager ids(packets);
+
+  GatherTestSocket socket;
+  socket.m_open = false;
+  {
+    PacketMuxer muxer(socket, packets, options);
+    while (!socket.m_stalled) {
+      std::this_thread::yield();
+    }
+
+    for (VectorStream::CharType i = 0; i < 5; ++i) {
+      muxer.emplacePacket("State", &i, 1);
+      muxer.emplacePacket("Event", &i, 1);
+    }
+    for (VectorStream::CharType i = 10; i < 12; ++i) {
+      muxer.emplaceKeyedPacket("State", 7, &i, 1);
+    }
+
+    socket.m_open = true;
+    while (muxer.getNumSent() + muxer.getNumConflated() != muxer.getNumPosted()) {
+      std::this_thread::yield();
+    }
+    BOOST_CHECK_EQUAL(5, muxer.getNumConflated("State"));
+    BOOST_CHECK_EQUAL(0, muxer.getNumConflated("Event"));
+  }
+
+  // Only the latest value for each key is sent:
+  const auto states = socket.payloads(ids.toId("State"));
+  BOOST_REQUIRE_EQUAL(2, states.size());
+  BOOST_CHECK_EQUAL(4, states[0].at(0));
+  BOOST_CHECK_EQUAL(11, states[1].at(0));
+  BOOST_CHECK_EQUAL(5, socket.payloads(ids.toId("Event")).size());
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketMuxerFlush) {
+  MuxerOptions options;
+  options.sendThread                     = false;
+  options.inlineSend                     = true;
+  const std::vector<std::string> packets = {"Type1"};
+  IdManager ids(packets);
+
+  GatherTestSocket socket;
+  PacketMuxer muxer(socket, packets, options);
+
+  // Nothing is written until the muxer is flushed (the 'Hello' was posted by the constructor):
+  BOOST_CHECK_EQUAL(0, socket.m_writevCalls);
+  BOOST_CHECK(!muxer.flush());
+  BOOST_CHECK_EQUAL(1, muxer.getNumSent());
+
+  // With nothing queued a posted packet is written by the posting thread:
+  VectorStream::CharType byte = 1;
+  BOOST_CHECK(muxer.emplacePacket("Type1", &byte, 1));
+  BOOST_CHECK_EQUAL(2, muxer.getNumSent());
+
+  // Otherwise packets wait for the next flush:
+  socket.m_open = false;
+  byte          = 2;
+  BOOST_CHECK(muxer.emplacePacket("Type1", &byte, 1));
+  byte = 3;
+  BOOST_CHECK(muxer.emplacePacket("Type1", &byte, 1));
+  BOOST_CHECK(muxer.flush());
+  BOOST_CHECK_EQUAL(2, muxer.getNumSent());
+
+  socket.m_open = true;
+  BOOST_CHECK(!muxer.flush());
+  BOOST_CHECK_EQUAL(4, muxer.getNumSent());
+  BOOST_CHECK(muxer.ok());
+
+  const auto payloads = socket.payloads(ids.toId("Type1"));
+  BOOST_REQUIRE_EQUAL(3, payloads.size());
+  for (std::size_t i = 0; i < payloads.size(); ++i) {
+    BOOST_CHECK_EQUAL(i + 1, payloads[i].at(0));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketMuxerInlineSend) {
+  constexpr int numPackets = 1000;
+  MuxerOptions options;
+  options.inlineSend                     = true;
+  const std::vector<std::string> packets = {"Type1"};
+  IdManager ids(packets);
+
+  // Packets sent inline and by the send thread stay in order:
+  GatherTestSocket socket;
+  {
+    PacketMuxer muxer(socket, packets, options);
+    for (int i = 0; i < numPackets; ++i) {
+      const auto byte = static_cast<VectorStream::CharType>(i);
+      BOOST_CHECK(muxer.emplacePacket("Type1", &byte, 1));
+    }
+    while (muxer.getNumSent() != muxer.getNumPosted()) {
+      std::this_thread::yield();
+    }
+  }
+
+  const auto payloads = socket.payloads(ids.toId("Type1"));
+  BOOST_REQUIRE_EQUAL(numPackets, payloads.size());
+  for (int i = 0; i < numPackets; ++i) {
+    BOOST_CHECK_EQUAL(static_cast<VectorStream::CharType>(i), payloads[i].at(0));
+  }
+}
+
 BOOST_AUTO_TEST_CASE(TestDemuxerExitsCleanly) {
   AlwaysFailSocket socket;
   PacketDemuxer demuxer(socket, {});
@@ -261,6 +1143,433 @@ BOOST_AUTO_TEST_CASE(TestPacketDemuxer) {
   PacketDemuxer demuxer(socket, {});
 }
 
+BOOST_AUTO_TEST_CASE(TestPacketDemuxerBufferedReads) {
+  constexpr int numPackets = 200;
+  StreamTestSocket socket;
+  socket.appendPacket(IdManager::ControlPacket, {static_cast<char>(ControlMessage::Hello)});
+  for (int i = 0; i < numPackets; ++i) {
+    socket.appendPacket(IdManager::ControlPacket + 1, std::vector<char>(i % 17, static_cast<char>(i)));
+  }
+  // One payload too big for the receive buffer:
+  socket.appendPacket(IdManager::ControlPacket + 1, std::vector<char>(200 * 1024, 'x'));
+
+  PacketDemuxer demuxer(socket, {"MockPacket"});
+  std::atomic<int> received(0);
+  std::atomic<bool> payloadsOk(true);
+  auto subscription = demuxer.subscribe("MockPacket", [&](const ComPacket::ConstSharedPacket& packet) {
+    const int i = received;
+    if (i < numPackets) {
+      payloadsOk = payloadsOk && packet->getDataSize() == std::size_t(i % 17) &&
+                   std::all_of(packet->getDataPtr(), packet->getDataPtr() + packet->getDataSize(),
+                               [i](char c) { return c == static_cast<char>(i); });
+    } else {
+      payloadsOk = payloadsOk && packet->getDataSize() == 200 * 1024;
+    }
+    received += 1;
+  });
+
+  const int readsBeforeOpen = socket.m_readCalls;
+  socket.open();
+  while (received != numPackets + 1) {
+    std::this_thread::yield();
+  }
+
+  BOOST_CHECK(payloadsOk);
+  BOOST_CHECK(demuxer.ok());
+  // Many packets per read on average:
+  BOOST_CHECK_LT(socket.m_readCalls - readsBeforeOpen, numPackets / 10);
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketDemuxerSubscribeDuringDispatch) {
+  StreamTestSocket socket;
+  const IdManager::PacketType type1 = IdManager::ControlPacket + 1;
+  const IdManager::PacketType type2 = IdManager::ControlPacket + 2;
+  socket.appendPacket(IdManager::ControlPacket, {static_cast<char>(ControlMessage::Hello)});
+  socket.appendPacket(type1, {'a'});
+  socket.appendPacket(type2, {'b'});
+  socket.appendPacket(type1, {'c'});
+
+  PacketDemuxer demuxer(socket, {"Type1", "Type2"});
+  std::atomic<bool> inCallback(false);
+  std::atomic<bool> release(false);
+  std::atomic<int> received1(0);
+  std::atomic<int> received2(0);
+  PacketSubscription subscription1;
+  PacketSubscription subscription2;
+  subscription1 = demuxer.subscribe("Type1", [&](const ComPacket::ConstSharedPacket&) {
+    received1 += 1;
+    if (received1 == 1) {
+      // Subscribing from a callback must not deadlock:
+      subscription2 = demuxer.subscribe("Type2", [&](const ComPacket::ConstSharedPacket&) { received2 += 1; });
+      inCallback = true;
+      while (!release) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  socket.open();
+  while (!inCallback) {
+    std::this_thread::yield();
+  }
+
+  // Another thread can subscribe while a callback is running:
+  std::atomic<int> received3(0);
+  auto subscription3 = demuxer.subscribe("Type1", [&](const ComPacket::ConstSharedPacket&) { received3 += 1; });
+  BOOST_CHECK(subscription3.isSubscribed());
+  release = true;
+
+  while (received3 != 1) {
+    std::this_thread::yield();
+  }
+  BOOST_CHECK_EQUAL(2, received1);
+  BOOST_CHECK_EQUAL(1, received2);
+  BOOST_CHECK(subscription2.isSubscribed());
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketDemuxerQueuedSubscribers) {
+  constexpr int numPackets = 50;
+  const IdManager::PacketType type = IdManager::ControlPacket + 1;
+  StreamTestSocket socket;
+  socket.appendPacket(IdManager::ControlPacket, {static_cast<char>(ControlMessage::Hello)});
+  for (int i = 0; i < numPackets; ++i) {
+    socket.appendPacket(type, {static_cast<char>(i)});
+  }
+
+  PacketDemuxer demuxer(socket, {"MockPacket"});
+
+  // A slow subscriber with its own queue:
+  std::atomic<bool> inCallback(false);
+  std::atomic<bool> release(false);
+  std::vector<int> slowReceived;
+  SubscriberOptions options;
+  options.queueLength = 4;
+  options.overflow    = Overflow::DropOldest;
+  auto slow = demuxer.subscribe("MockPacket", [&](const ComPacket::ConstSharedPacket& packet) {
+    inCallback = true;
+    while (!release) {
+      std::this_thread::yield();
+    }
+    slowReceived.push_back(packet->getDataPtr()[0]);
+  }, options);
+
+  // Must not be held up by it:
+  std::atomic<int> fastReceived(0);
+  auto fast = demuxer.subscribe("MockPacket", [&](const ComPacket::ConstSharedPacket&) {
+    fastReceived += 1;
+  });
+
+  socket.open();
+  while (fastReceived != numPackets || !inCallback) {
+    std::this_thread::yield();
+  }
+
+  // Everything has been queued or dropped (the worker may have taken its first packet from a full queue):
+  const SubscriberStats stats = slow.getStats();
+  BOOST_CHECK_EQUAL(0u, stats.delivered);
+  BOOST_CHECK_LE(stats.queueDepth, options.queueLength);
+  BOOST_CHECK_EQUAL(options.queueLength, stats.queueHighWater);
+  BOOST_CHECK_EQUAL(numPackets - 1, stats.dropped + stats.queueDepth);
+  BOOST_CHECK_EQUAL(numPackets, fast.getStats().delivered);
+
+  release = true;
+  while (slow.getStats().delivered != stats.queueDepth + 1) {
+    std::this_thread::yield();
+  }
+
+  // The newest packets were kept:
+  BOOST_REQUIRE_EQUAL(stats.queueDepth + 1, slowReceived.size());
+  BOOST_CHECK_EQUAL(numPackets - 1, slowReceived.back());
+  BOOST_CHECK_EQUAL(0u, slow.getStats().queueDepth);
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketDemuxerBlockingSubscriberQueue) {
+  constexpr int numPackets = 20;
+  const IdManager::PacketType type = IdManager::ControlPacket + 1;
+  StreamTestSocket socket;
+  socket.appendPacket(IdManager::ControlPacket, {static_cast<char>(ControlMessage::Hello)});
+  for (int i = 0; i < numPackets; ++i) {
+    socket.appendPacket(type, {static_cast<char>(i)});
+  }
+
+  PacketDemuxer demuxer(socket, {"MockPacket"});
+  SubscriberOptions options;
+  options.queueLength = 2;
+  options.overflow    = Overflow::Block;
+  std::vector<int> received;
+  auto subscription = demuxer.subscribe("MockPacket", [&](const ComPacket::ConstSharedPacket& packet) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    received.push_back(packet->getDataPtr()[0]);
+  }, options);
+
+  socket.open();
+  while (subscription.getStats().delivered != numPackets) {
+    std::this_thread::yield();
+  }
+
+  const SubscriberStats stats = subscription.getStats();
+  BOOST_CHECK_EQUAL(0u, stats.dropped);
+  BOOST_CHECK_LE(stats.queueHighWater, options.queueLength);
+  BOOST_REQUIRE_EQUAL(numPackets, received.size());
+  for (int i = 0; i < numPackets; ++i) {
+    BOOST_CHECK_EQUAL(i, received[i]);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketDemuxerBatchSubscribers) {
+  constexpr int numPackets = 100;
+  const IdManager::PacketType type1 = IdManager::ControlPacket + 1;
+  const IdManager::PacketType type2 = IdManager::ControlPacket + 2;
+  StreamTestSocket socket;
+  socket.appendPacket(IdManager::ControlPacket, {static_cast<char>(ControlMessage::Hello)});
+  for (int i = 0; i < numPackets; ++i) {
+    socket.appendPacket(type1, {static_cast<char>(i)});
+    socket.appendPacket(type2, {});
+  }
+
+  PacketDemuxer demuxer(socket, {"Type1", "Type2"});
+
+  // The whole stream arrives in one read so makes a single batch:
+  std::vector<std::size_t> batchSizes;
+  std::vector<int> batched;
+  auto all = demuxer.subscribeBatch("Type1", [&](const PacketSpan& packets) {
+    batchSizes.push_back(packets.size());
+    for (const auto& packet : packets) {
+      batched.push_back(packet->getDataPtr()[0]);
+    }
+  });
+
+  // Unless the batch size is limited:
+  SubscriberOptions options;
+  options.maxBatch = 30;
+  std::vector<std::size_t> limitedSizes;
+  auto limited = demuxer.subscribeBatch(Channel<>(type1), [&](const PacketSpan& packets) {
+    limitedSizes.push_back(packets.size());
+  }, options);
+
+  // Per packet subscribers still work alongside batches:
+  std::atomic<int> single(0);
+  auto perPacket = demuxer.subscribe("Type1", [&](const ComPacket::ConstSharedPacket&) { single += 1; });
+
+  socket.open();
+  while (all.getStats().delivered != numPackets || limited.getStats().delivered != numPackets) {
+    std::this_thread::yield();
+  }
+
+  BOOST_CHECK_EQUAL(numPackets, single);
+  BOOST_REQUIRE_EQUAL(1u, batchSizes.size());
+  BOOST_CHECK_EQUAL(numPackets, batchSizes[0]);
+  BOOST_REQUIRE_EQUAL(numPackets, batched.size());
+  for (int i = 0; i < numPackets; ++i) {
+    BOOST_CHECK_EQUAL(i, batched[i]);
+  }
+  const std::vector<std::size_t> expected = {30, 30, 30, 10};
+  BOOST_CHECK_EQUAL_COLLECTIONS(expected.begin(), expected.end(), limitedSizes.begin(), limitedSizes.end());
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketDemuxerPoll) {
+  StreamTestSocket socket;
+  const IdManager::PacketType type = IdManager::ControlPacket + 1;
+  socket.appendPacket(IdManager::ControlPacket, {static_cast<char>(ControlMessage::Hello)});
+  for (int i = 0; i < 5; ++i) {
+    socket.appendPacket(type, {static_cast<char>(i)});
+  }
+
+  DemuxerOptions options;
+  options.receiveThread = false;
+  PacketDemuxer demuxer(socket, {"Type1"}, options);
+
+  // Callbacks are called on the polling thread before poll() returns:
+  std::vector<int> received;
+  std::thread::id callbackThread;
+  auto subscription = demuxer.subscribe("Type1", [&](const ComPacket::ConstSharedPacket& packet) {
+    received.push_back(packet->getDataPtr()[0]);
+    callbackThread = std::this_thread::get_id();
+  });
+
+  BOOST_CHECK_EQUAL(0, demuxer.poll(10, 0));
+  socket.open();
+
+  // Asking for no packets does not mistake the readable transport for a closed one:
+  BOOST_CHECK_EQUAL(0, demuxer.poll(0, 20));
+  BOOST_CHECK(demuxer.ok());
+
+  BOOST_CHECK_EQUAL(3, demuxer.poll(3, 0));  // The 'Hello' message counts.
+  BOOST_CHECK_EQUAL(2, received.size());
+  BOOST_CHECK(callbackThread == std::this_thread::get_id());
+
+  BOOST_CHECK_EQUAL(3, demuxer.poll(10, 0));
+  BOOST_CHECK_EQUAL(0, demuxer.poll(10, 20));
+  BOOST_CHECK(demuxer.ok());
+
+  const std::vector<int> expected = {0, 1, 2, 3, 4};
+  BOOST_CHECK_EQUAL_COLLECTIONS(expected.begin(), expected.end(), received.begin(), received.end());
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketDemuxerPollLargePayload) {
+  StreamTestSocket socket;
+  const IdManager::PacketType type = IdManager::ControlPacket + 1;
+  socket.appendPacket(IdManager::ControlPacket, {static_cast<char>(ControlMessage::Hello)});
+  socket.appendPacket(type, std::vector<char>(200 * 1024, 'x'));
+
+  // Only part of the payload has arrived so far:
+  std::vector<char> rest(socket.m_bytes.begin() + 100 * 1024, socket.m_bytes.end());
+  socket.m_bytes.resize(100 * 1024);
+
+  DemuxerOptions options;
+  options.receiveThread = false;
+  PacketDemuxer demuxer(socket, {"Type1"}, options);
+
+  std::size_t receivedSize = 0;
+  auto subscription = demuxer.subscribe("Type1", [&](const ComPacket::ConstSharedPacket& packet) {
+    receivedSize = packet->getDataSize();
+  });
+  socket.open();
+
+  // The partial payload is kept and poll() returns instead of waiting for the rest:
+  BOOST_CHECK_EQUAL(1, demuxer.poll(10, 0));
+  BOOST_CHECK_EQUAL(0, demuxer.poll(10, 0));
+  BOOST_CHECK_EQUAL(0, receivedSize);
+  BOOST_CHECK(demuxer.ok());
+
+  socket.m_bytes.insert(socket.m_bytes.end(), rest.begin(), rest.end());
+  BOOST_CHECK_EQUAL(1, demuxer.poll(10, 0));
+  BOOST_CHECK_EQUAL(200 * 1024, receivedSize);
+  BOOST_CHECK(demuxer.ok());
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketDemuxerPollHangUp) {
+  StreamTestSocket socket;
+  const IdManager::PacketType type = IdManager::ControlPacket + 1;
+  socket.appendPacket(IdManager::ControlPacket, {static_cast<char>(ControlMessage::Hello)});
+  socket.appendPacket(type, std::vector<char>(200 * 1024, 'x'));
+  socket.m_bytes.resize(100 * 1024);
+
+  DemuxerOptions options;
+  options.receiveThread = false;
+  PacketDemuxer demuxer(socket, {"Type1"}, options);
+  socket.open();
+  BOOST_CHECK_EQUAL(1, demuxer.poll(10, 0));
+  BOOST_CHECK(demuxer.ok());
+
+  // Readable but no bytes means the peer closed part way through the payload:
+  socket.hangUp();
+  BOOST_CHECK_EQUAL(0, demuxer.poll(10, 20));
+  BOOST_CHECK(demuxer.ok() == false);
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketDemuxerPollHangUpZeroTimeout) {
+  StreamTestSocket socket;
+  const IdManager::PacketType type = IdManager::ControlPacket + 1;
+  socket.appendPacket(IdManager::ControlPacket, {static_cast<char>(ControlMessage::Hello)});
+  socket.appendPacket(type, {'a'});
+
+  DemuxerOptions options;
+  options.receiveThread = false;
+  PacketDemuxer demuxer(socket, {"Type1"}, options);
+  socket.open();
+  BOOST_CHECK_EQUAL(2, demuxer.poll(10, 0));
+  BOOST_CHECK_EQUAL(0, demuxer.poll(10, 0));
+  BOOST_CHECK(demuxer.ok());
+
+  // A caller that never waits still sees the peer close between packets:
+  socket.hangUp();
+  BOOST_CHECK_EQUAL(0, demuxer.poll(10, 0));
+  BOOST_CHECK(demuxer.ok() == false);
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketDemuxerUnknownTypes) {
+  StreamTestSocket socket;
+  const IdManager::PacketType known   = IdManager::ControlPacket + 1;
+  const IdManager::PacketType unknown = IdManager::ControlPacket + 2;
+  socket.appendPacket(IdManager::ControlPacket, {static_cast<char>(ControlMessage::Hello)});
+  socket.appendPacket(unknown, {'a', 'b'});
+  socket.appendPacket(known, {'c'});
+  socket.appendPacket(unknown | MoreFragmentsFlag, {'d'});
+  socket.appendPacket(unknown, {'e'});
+  socket.appendPacket(1000000, {});
+  socket.appendPacket(known, {'f'});
+
+  PacketDemuxer demuxer(socket, {"MockPacket"});
+  std::atomic<int> received(0);
+  auto subscription = demuxer.subscribe("MockPacket", [&](const ComPacket::ConstSharedPacket&) {
+    received += 1;
+  });
+
+  socket.open();
+  while (received != 2) {
+    std::this_thread::yield();
+  }
+
+  BOOST_CHECK(demuxer.ok());
+  const DemuxerStats stats = demuxer.getStats();
+  BOOST_CHECK_EQUAL(3u, stats.unknownPackets);
+  BOOST_CHECK_EQUAL(2u, stats.types[known].packets);
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketDemuxerInvalidTypes) {
+  StreamTestSocket socket;
+  const IdManager::PacketType known = IdManager::ControlPacket + 1;
+  socket.appendPacket(IdManager::ControlPacket, {static_cast<char>(ControlMessage::Hello)});
+  socket.appendPacket(IdManager::InvalidPacket, std::vector<char>(1000, 'x'));
+  socket.appendPacket(1000000, std::vector<char>(200 * 1024, 'y'));
+  socket.appendPacket(known, {'c'});
+
+  // The large payload arrives in two parts:
+  std::vector<char> rest(socket.m_bytes.begin() + 100 * 1024, socket.m_bytes.end());
+  socket.m_bytes.resize(100 * 1024);
+
+  DemuxerOptions options;
+  options.receiveThread = false;
+  PacketDemuxer demuxer(socket, {"MockPacket"}, options);
+  int received      = 0;
+  auto subscription = demuxer.subscribe("MockPacket", [&](const ComPacket::ConstSharedPacket& packet) {
+    BOOST_CHECK_EQUAL('c', packet->getDataPtr()[0]);
+    received += 1;
+  });
+
+  socket.open();
+  BOOST_CHECK_EQUAL(1, demuxer.poll(10, 0));  // Only 'Hello' is delivered.
+  socket.m_bytes.insert(socket.m_bytes.end(), rest.begin(), rest.end());
+  BOOST_CHECK_EQUAL(1, demuxer.poll(10, 0));
+  BOOST_CHECK_EQUAL(1, received);
+
+  // Rejected payloads are skipped without being allocated:
+  BOOST_CHECK(demuxer.ok());
+  BOOST_CHECK_EQUAL(2u, demuxer.getStats().unknownPackets);
+  BOOST_CHECK_EQUAL(1u, demuxer.getBufferPool().getNumHeapAllocations());  // The delivered packet.
+}
+
+BOOST_AUTO_TEST_CASE(TestPacketDemuxerReassemblyLimit) {
+  StreamTestSocket socket;
+  const IdManager::PacketType type = IdManager::ControlPacket + 1;
+  socket.appendPacket(IdManager::ControlPacket, {static_cast<char>(ControlMessage::Hello)});
+  for (int i = 0; i < 2; ++i) {
+    socket.appendPacket(type | MoreFragmentsFlag, std::vector<char>(600, 'a'));
+  }
+  socket.appendPacket(type, std::vector<char>(600, 'a'));
+  socket.appendPacket(type | MoreFragmentsFlag, std::vector<char>(300, 'b'));
+  socket.appendPacket(type, std::vector<char>(300, 'c'));
+
+  DemuxerOptions options;
+  options.receiveThread       = false;
+  options.maxReassembledBytes = 1000;
+  PacketDemuxer demuxer(socket, {"Type1"}, options);
+  std::vector<std::string> received;
+  auto subscription = demuxer.subscribe("Type1", [&](const ComPacket::ConstSharedPacket& packet) {
+    received.emplace_back(packet->getDataPtr(), packet->getDataPtr() + packet->getDataSize());
+  });
+
+  socket.open();
+  BOOST_CHECK_EQUAL(2, demuxer.poll(10, 0));
+
+  // The packet over the limit is discarded up to its last fragment and the next one is unaffected:
+  BOOST_REQUIRE_EQUAL(1, received.size());
+  BOOST_CHECK(received[0] == std::string(300, 'b') + std::string(300, 'c'));
+  BOOST_CHECK_EQUAL(1u, demuxer.getStats().unknownPackets);
+  BOOST_CHECK(demuxer.ok());
+}
+
 const int MSG_SIZE           = 8;
 const char TEST_MSG[MSG_SIZE] = "1234abc";
 const char UDP_MSG[]     = "Udp connection-less Datagram!";
@@ -316,6 +1625,225 @@ BOOST_AUTO_TEST_CASE(TestTcp) {
 #endif
 }
 
+#ifdef __linux
+BOOST_AUTO_TEST_CASE(TestReactor) {
+  const int TEST_PORT       = 2010;
+  constexpr int numClients  = 4;
+  constexpr int numPings    = 200;
+  const std::vector<std::string> packetIds = {"Ping", "Pong"};
+
+  TcpSocket server;
+  BOOST_REQUIRE(server.IsValid());
+  BOOST_REQUIRE(server.Bind(TEST_PORT));
+  BOOST_REQUIRE(server.Listen(numClients));
+
+  // Clients use ordinary threaded muxers and demuxers:
+  struct Client {
+    TcpSocket socket;
+    std::unique_ptr<PacketMuxer> muxer;
+    std::unique_ptr<PacketDemuxer> demuxer;
+    std::atomic<int> pongs{0};
+  };
+
+  Reactor reactor(2);
+  std::vector<std::unique_ptr<Client>> clients;
+  std::vector<Reactor::ConnectionPtr> connections;
+  for (int i = 0; i < numClients; ++i) {
+    clients.emplace_back(new Client());
+    BOOST_REQUIRE(clients.back()->socket.Connect("localhost", TEST_PORT));
+    std::unique_ptr<TcpSocket> accepted = server.Accept();
+    BOOST_REQUIRE(accepted);
+    connections.push_back(reactor.add(std::move(accepted), packetIds));
+  }
+  BOOST_CHECK_EQUAL(numClients, reactor.numConnections());
+
+  // The server side of every connection echoes pings back as pongs from the loop threads:
+  std::vector<PacketSubscription> subscriptions;
+  for (const auto& connection : connections) {
+    Reactor::Connection* c = connection.get();
+    subscriptions.push_back(c->demuxer().subscribe("Ping", [c](const ComPacket::ConstSharedPacket& packet) {
+      c->muxer().emplacePacket("Pong", packet->getDataPtr(), packet->getDataSize());
+    }));
+  }
+
+  for (auto& client : clients) {
+    Client* c  = client.get();
+    c->muxer   = std::make_unique<PacketMuxer>(c->socket, packetIds);
+    c->demuxer = std::make_unique<PacketDemuxer>(c->socket, packetIds);
+    subscriptions.push_back(c->demuxer->subscribe("Pong", [c](const ComPacket::ConstSharedPacket&) { c->pongs += 1; }));
+  }
+
+  const std::vector<VectorStream::CharType> payload(100, 'x');
+  for (int i = 0; i < numPings; ++i) {
+    for (auto& client : clients) {
+      BOOST_CHECK(client->muxer->emplacePacket("Ping", payload.data(), static_cast<int>(payload.size())));
+    }
+  }
+
+  for (auto& client : clients) {
+    while (client->pongs != numPings) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  for (const auto& connection : connections) {
+    BOOST_CHECK(connection->ok());
+    const IdManager::PacketType pong = connection->muxer().getIdManager().toId("Pong");
+    BOOST_CHECK_EQUAL(numPings, connection->muxer().getStats().types[pong].packets);
+  }
+
+  // Closing a connection removes it from its loop and fails its muxer:
+  connections[0]->close();
+  while (reactor.numConnections() != numClients - 1) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  BOOST_CHECK(connections[0]->ok() == false);
+  BOOST_CHECK(connections[0]->muxer().emplacePacket("Pong", payload.data(), static_cast<int>(payload.size())) == false);
+  BOOST_CHECK(connections[1]->ok());
+
+  subscriptions.clear();
+}
+
+BOOST_AUTO_TEST_CASE(TestReactorHalfClose) {
+  const int TEST_PORT       = 2012;
+  constexpr int numPings    = 500;
+  const std::vector<std::string> packetIds = {"Ping", "Pong"};
+
+  TcpSocket server;
+  BOOST_REQUIRE(server.IsValid());
+  BOOST_REQUIRE(server.Bind(TEST_PORT));
+  BOOST_REQUIRE(server.Listen(1));
+
+  Reactor reactor(1);
+  TcpSocket client;
+  BOOST_REQUIRE(client.Connect("localhost", TEST_PORT));
+  std::unique_ptr<TcpSocket> accepted = server.Accept();
+  BOOST_REQUIRE(accepted);
+  Reactor::ConnectionPtr connection = reactor.add(std::move(accepted), packetIds);
+
+  std::atomic<int> pings(0);
+  auto pingSubscription = connection->demuxer().subscribe("Ping", [&](const ComPacket::ConstSharedPacket&) {
+    pings += 1;
+  });
+
+  // Send more than one read's worth of pings and then stop sending:
+  auto clientMuxer = std::make_unique<PacketMuxer>(client, packetIds);
+  const std::vector<VectorStream::CharType> payload(100, 'x');
+  for (int i = 0; i < numPings; ++i) {
+    BOOST_CHECK(clientMuxer->emplacePacket("Ping", payload.data(), static_cast<int>(payload.size())));
+  }
+  while (clientMuxer->getNumSent() != clientMuxer->getNumPosted()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  clientMuxer.reset();
+  BOOST_REQUIRE(::shutdown(client.GetFileDescriptor(), SHUT_WR) == 0);
+
+  // Everything that was sent before the half close is received:
+  while (connection->demuxer().ok()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  BOOST_CHECK_EQUAL(numPings, pings);
+
+  // ... and the connection can still send to the peer:
+  std::atomic<int> pongs(0);
+  PacketDemuxer clientDemuxer(client, packetIds);
+  auto pongSubscription = clientDemuxer.subscribe("Pong", [&](const ComPacket::ConstSharedPacket&) { pongs += 1; });
+  BOOST_CHECK(connection->muxer().emplacePacket("Pong", payload.data(), static_cast<int>(payload.size())));
+  while (pongs != 1) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  BOOST_CHECK(connection->muxer().ok());
+  BOOST_CHECK_EQUAL(1, reactor.numConnections());
+
+  connection->close();
+  while (reactor.numConnections() != 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestReactorDestroyedFirst) {
+  const int TEST_PORT       = 2013;
+  const std::vector<std::string> packetIds = {"Ping"};
+
+  TcpSocket server;
+  BOOST_REQUIRE(server.IsValid());
+  BOOST_REQUIRE(server.Bind(TEST_PORT));
+  BOOST_REQUIRE(server.Listen(1));
+
+  TcpSocket client;
+  BOOST_REQUIRE(client.Connect("localhost", TEST_PORT));
+  std::unique_ptr<TcpSocket> accepted = server.Accept();
+  BOOST_REQUIRE(accepted);
+
+  Reactor::ConnectionPtr connection;
+  {
+    Reactor reactor(1);
+    connection = reactor.add(std::move(accepted), packetIds);
+    BOOST_REQUIRE(client.readyForReading(1000));  // The loop has serviced it (sent 'Hello').
+  }
+
+  // The connection outlives its loop, so using it must not touch the loop:
+  BOOST_CHECK(connection->ok() == false);
+  const char ping = 'p';
+  BOOST_CHECK(connection->muxer().emplacePacket("Ping", &ping, 1) == false);
+  connection->close();
+  BOOST_CHECK(connection->ok() == false);
+}
+
+BOOST_AUTO_TEST_CASE(TestTcpServer) {
+  const int TEST_PORT       = 2011;
+  constexpr int numClients  = 8;
+  const std::vector<std::string> packetIds = {"Ping", "Pong"};
+
+  // Accepted connections echo pings as pongs. Subscribing in the callback can not miss packets:
+  std::mutex lock;
+  std::vector<Reactor::ConnectionPtr> connections;
+  std::vector<PacketSubscription> subscriptions;
+  Reactor reactor(2);
+  TcpServer server(reactor, TEST_PORT, packetIds, [&](const Reactor::ConnectionPtr& connection) {
+    Reactor::Connection* c = connection.get();
+    std::lock_guard<std::mutex> guard(lock);
+    connections.push_back(connection);
+    subscriptions.push_back(c->demuxer().subscribe("Ping", [c](const ComPacket::ConstSharedPacket& packet) {
+      c->muxer().emplacePacket("Pong", packet->getDataPtr(), packet->getDataSize());
+    }));
+  });
+  BOOST_REQUIRE(server.ok());
+  BOOST_CHECK_EQUAL(reactor.numThreads(), server.numShards());
+
+  struct Client {
+    TcpSocket socket;
+    std::unique_ptr<PacketMuxer> muxer;
+    std::unique_ptr<PacketDemuxer> demuxer;
+    std::atomic<int> pongs{0};
+  };
+
+  std::vector<std::unique_ptr<Client>> clients;
+  std::vector<PacketSubscription> clientSubscriptions;
+  for (int i = 0; i < numClients; ++i) {
+    clients.emplace_back(new Client());
+    Client* c = clients.back().get();
+    BOOST_REQUIRE(c->socket.Connect("localhost", TEST_PORT));
+    c->muxer   = std::make_unique<PacketMuxer>(c->socket, packetIds);
+    c->demuxer = std::make_unique<PacketDemuxer>(c->socket, packetIds);
+    clientSubscriptions.push_back(c->demuxer->subscribe("Pong", [c](const ComPacket::ConstSharedPacket&) { c->pongs += 1; }));
+    const char ping = static_cast<char>(i);
+    BOOST_CHECK(c->muxer->emplacePacket("Ping", &ping, 1));
+  }
+
+  for (auto& client : clients) {
+    while (client->pongs != 1) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  BOOST_CHECK_EQUAL(numClients, server.getNumAccepted());
+  BOOST_CHECK_EQUAL(numClients, reactor.numConnections());
+
+  clientSubscriptions.clear();
+  std::lock_guard<std::mutex> guard(lock);
+  subscriptions.clear();
+}
+#endif
+
 /*
     Server waits for messages from client and checks they are correct.
 */